@@ -0,0 +1,168 @@
+#include "Collision.hpp"
+
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+#if defined(COLLISION_HAS_SSE2) || defined(COLLISION_HAS_AVX2)
+#include <immintrin.h>
+#endif
+
+void BoxesSoA::clear() {
+	left.clear();
+	right.clear();
+	bottom.clear();
+	top.clear();
+}
+
+void BoxesSoA::push(glm::vec2 const &min, glm::vec2 const &max) {
+	left.emplace_back(min.x);
+	right.emplace_back(max.x);
+	bottom.emplace_back(min.y);
+	top.emplace_back(max.y);
+}
+
+void BoxesSoA::push_empty() {
+	//inside-out box: every separating-axis test succeeds against it (unless the query box has NaNs)
+	constexpr float Inf = std::numeric_limits< float >::infinity();
+	push(glm::vec2(Inf), glm::vec2(-Inf));
+}
+
+void BoxesSoA::pad() {
+	while (size() % BoxBatch != 0) {
+		push_empty();
+	}
+}
+
+uint32_t overlap_mask_scalar(QueryBox const &box, BoxesSoA const &boxes, size_t first) {
+	assert(first % BoxBatch == 0 && first + BoxBatch <= boxes.size());
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < BoxBatch; ++i) {
+		//same tests as Game::check_collision:
+		bool outside = (box.bottom >= boxes.top[first + i])
+		            || (box.top <= boxes.bottom[first + i])
+		            || (box.right <= boxes.left[first + i])
+		            || (box.left >= boxes.right[first + i]);
+		if (!outside) mask |= (1u << i);
+	}
+	return mask;
+}
+
+#ifdef COLLISION_HAS_SSE2
+uint32_t overlap_mask_sse2(QueryBox const &box, BoxesSoA const &boxes, size_t first) {
+	assert(first % BoxBatch == 0 && first + BoxBatch <= boxes.size());
+	__m128 bottomA = _mm_set1_ps(box.bottom);
+	__m128 topA = _mm_set1_ps(box.top);
+	__m128 rightA = _mm_set1_ps(box.right);
+	__m128 leftA = _mm_set1_ps(box.left);
+
+	uint32_t mask = 0;
+	for (uint32_t g = 0; g < BoxBatch; g += 4) {
+		//n.b. ordered comparisons are false for NaN, just like the scalar operators:
+		__m128 outside = _mm_or_ps(
+			_mm_or_ps(
+				_mm_cmpge_ps(bottomA, _mm_loadu_ps(&boxes.top[first + g])),
+				_mm_cmple_ps(topA, _mm_loadu_ps(&boxes.bottom[first + g]))
+			),
+			_mm_or_ps(
+				_mm_cmple_ps(rightA, _mm_loadu_ps(&boxes.left[first + g])),
+				_mm_cmpge_ps(leftA, _mm_loadu_ps(&boxes.right[first + g]))
+			)
+		);
+		mask |= (uint32_t(~_mm_movemask_ps(outside)) & 0xfu) << g;
+	}
+	return mask;
+}
+#endif
+
+#ifdef COLLISION_HAS_AVX2
+__attribute__((target("avx2")))
+uint32_t overlap_mask_avx2(QueryBox const &box, BoxesSoA const &boxes, size_t first) {
+	static_assert(BoxBatch == 8, "AVX2 path tests exactly 8 boxes.");
+	assert(first % BoxBatch == 0 && first + BoxBatch <= boxes.size());
+	__m256 outside = _mm256_or_ps(
+		_mm256_or_ps(
+			_mm256_cmp_ps(_mm256_set1_ps(box.bottom), _mm256_loadu_ps(&boxes.top[first]), _CMP_GE_OQ),
+			_mm256_cmp_ps(_mm256_set1_ps(box.top), _mm256_loadu_ps(&boxes.bottom[first]), _CMP_LE_OQ)
+		),
+		_mm256_or_ps(
+			_mm256_cmp_ps(_mm256_set1_ps(box.right), _mm256_loadu_ps(&boxes.left[first]), _CMP_LE_OQ),
+			_mm256_cmp_ps(_mm256_set1_ps(box.left), _mm256_loadu_ps(&boxes.right[first]), _CMP_GE_OQ)
+		)
+	);
+	return uint32_t(~_mm256_movemask_ps(outside)) & 0xffu;
+}
+#endif
+
+//pick the widest implementation the CPU supports (once):
+typedef uint32_t (*OverlapMaskFn)(QueryBox const &, BoxesSoA const &, size_t);
+static OverlapMaskFn const overlap_mask_fn = [](){
+	#ifdef COLLISION_HAS_AVX2
+	if (__builtin_cpu_supports("avx2")) return &overlap_mask_avx2;
+	#endif
+	#ifdef COLLISION_HAS_SSE2
+	return &overlap_mask_sse2;
+	#else
+	return &overlap_mask_scalar;
+	#endif
+}();
+
+uint32_t overlap_mask(QueryBox const &box, BoxesSoA const &boxes, size_t first) {
+	return overlap_mask_fn(box, boxes, first);
+}
+
+char const *overlap_mask_implementation() {
+	#ifdef COLLISION_HAS_AVX2
+	if (overlap_mask_fn == &overlap_mask_avx2) return "avx2";
+	#endif
+	#ifdef COLLISION_HAS_SSE2
+	if (overlap_mask_fn == &overlap_mask_sse2) return "sse2";
+	#endif
+	return "scalar";
+}
+
+//---------------------------------
+
+bool sweep_point_box(glm::vec2 const &p0, glm::vec2 const &p1, glm::vec2 const &min, glm::vec2 const &max, float *t_) {
+	assert(t_);
+	//slab test, keeping track of the time range the point is inside both slabs:
+	float enter = 0.0f;
+	float exit = 1.0f;
+	for (int axis = 0; axis < 2; ++axis) {
+		float d = p1[axis] - p0[axis];
+		if (d == 0.0f) {
+			if (!(p0[axis] > min[axis] && p0[axis] < max[axis])) return false;
+			continue;
+		}
+		float ta = (min[axis] - p0[axis]) / d;
+		float tb = (max[axis] - p0[axis]) / d;
+		enter = std::max(enter, std::min(ta, tb));
+		exit = std::min(exit, std::max(ta, tb));
+	}
+	if (!(enter < exit)) return false; //(open box, so just touching doesn't count)
+	*t_ = enter;
+	return true;
+}
+
+bool sweep_point_circle(glm::vec2 const &p0, glm::vec2 const &p1, glm::vec2 const &center, float radius, float *t_) {
+	assert(t_);
+	//solve |p0 + t * d - center|^2 = radius^2 for the first root:
+	glm::vec2 d = p1 - p0;
+	glm::vec2 f = p0 - center;
+	float c = glm::dot(f, f) - radius * radius;
+	if (c < 0.0f) { //starts inside
+		*t_ = 0.0f;
+		return true;
+	}
+	float a = glm::dot(d, d);
+	if (a == 0.0f) return false;
+	float b = glm::dot(f, d);
+	if (b >= 0.0f) return false; //moving away
+	float disc = b * b - a * c;
+	if (disc <= 0.0f) return false; //misses (or only grazes)
+	float t = (-b - std::sqrt(disc)) / a;
+	if (!(t < 1.0f)) return false;
+	*t_ = t;
+	return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+/*
+ * Batched axis-aligned box overlap tests (and swept versions for moving points).
+ *
+ * Boxes are stored as four separate arrays of edges ("structure of arrays")
+ * so that one query box can be tested against BoxBatch boxes at a time.
+ *
+ * Overlap uses the same rule as Game::check_collision: boxes that only touch
+ * along an edge do not overlap, and every path (scalar, SSE2, AVX2) gives
+ * bit-identical answers, including for NaN inputs.
+ */
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+//Number of boxes tested per overlap_mask() call:
+// (AVX2 tests all 8 at once, SSE2 tests two groups of 4)
+constexpr uint32_t BoxBatch = 8;
+
+//a box to test against a batch of boxes:
+struct QueryBox {
+	float left, right, bottom, top;
+	QueryBox(glm::vec2 const &min, glm::vec2 const &max) : left(min.x), right(max.x), bottom(min.y), top(max.y) { }
+};
+
+struct BoxesSoA {
+	std::vector< float > left, right, bottom, top;
+
+	size_t size() const { return left.size(); }
+
+	void clear();
+	void push(glm::vec2 const &min, glm::vec2 const &max);
+	//append a box that never overlaps anything:
+	void push_empty();
+	//append empty boxes until size() is a multiple of BoxBatch:
+	void pad();
+};
+
+//bit 'i' of the result is set if box 'first + i' overlaps 'box':
+// (first must be a multiple of BoxBatch and boxes must be padded)
+uint32_t overlap_mask(QueryBox const &box, BoxesSoA const &boxes, size_t first);
+
+//the individual implementations (mostly useful for testing):
+uint32_t overlap_mask_scalar(QueryBox const &box, BoxesSoA const &boxes, size_t first);
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLLISION_HAS_SSE2 1
+uint32_t overlap_mask_sse2(QueryBox const &box, BoxesSoA const &boxes, size_t first);
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define COLLISION_HAS_AVX2 1
+uint32_t overlap_mask_avx2(QueryBox const &box, BoxesSoA const &boxes, size_t first);
+#endif
+
+//name of the implementation overlap_mask() dispatches to ("avx2", "sse2", or "scalar"):
+char const *overlap_mask_implementation();
+
+//---- swept tests ----
+//These find the first time t in [0,1] at which a point moving from p0 to p1 is
+//inside a shape; to sweep a box or circle, grow the shape by its size first.
+
+//point vs. box (strictly inside [min,max], matching check_collision's "touching is not overlapping"):
+bool sweep_point_box(glm::vec2 const &p0, glm::vec2 const &p1, glm::vec2 const &min, glm::vec2 const &max, float *t);
+
+//point vs. circle (strictly closer than 'radius' to 'center'):
+bool sweep_point_circle(glm::vec2 const &p0, glm::vec2 const &p1, glm::vec2 const &center, float radius, float *t);
@@ -20,16 +20,37 @@ typedef int ssize_t;
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#ifdef IORING_RECV_MULTISHOT //(header is new enough for everything the io_uring back-end uses)
+#define CONNECTION_HAS_URING 1
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <poll.h>
+#endif
+#endif
 
 #define closesocket close
 
 #endif
 
 #include "Connection.hpp"
+#include "Trace.hpp"
 
 //------------------------------------------------------
 
@@ -38,6 +59,11 @@ typedef int ssize_t;
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <new>
+#include <iterator>
 
 //NOTE: much of the sockets code herein is based on http-tweak's single-header http server
 // see: https://github.com/ixchow/http-tweak
@@ -45,21 +71,326 @@ typedef int ssize_t;
 //Also, some help and examples for getaddrinfo from: https://beej.us/guide/bgnet/html/multi/syscalls.html
 
 
+void ByteQueue::append(void const *bytes, size_t count) {
+	if (count == 0) return;
+	std::memcpy(prepare(count), bytes, count);
+	commit(count);
+}
+
+uint8_t *ByteQueue::prepare(size_t count) {
+	if (storage.size() - tail < count) {
+		if (head >= size() && storage.size() - size() >= count) {
+			//enough consumed space to make room; slide queued bytes to the front:
+			// (costs size() <= head, i.e., no more than the bytes consumed since the last slide)
+			std::memmove(storage.data(), storage.data() + head, size());
+		} else {
+			//grow (at least doubling, so growth is amortized O(1) too):
+			std::vector< uint8_t > bigger(std::max(2 * storage.size(), size() + count));
+			if (!empty()) std::memcpy(bigger.data(), storage.data() + head, size());
+			storage.swap(bigger);
+		}
+		tail -= head;
+		head = 0;
+	}
+	return storage.data() + tail;
+}
+
+void Connection::send_shared(SharedBytes const &bytes) {
+	assert(bytes);
+	if (bytes->empty()) return;
+	if (datagram) {
+		//(datagrams are assembled by copying anyway, so just copy)
+		send_raw(bytes->data(), bytes->size());
+		return;
+	}
+	#ifdef _WIN32
+	//(no scatter-gather send in this back-end, so just copy)
+	send_raw(bytes->data(), bytes->size());
+	#else
+	shared_sends.emplace_back();
+	shared_sends.back().at = send_buffer_sent + send_buffer.size();
+	shared_sends.back().bytes = bytes;
+	shared_queued += bytes->size();
+	if (send_list && !on_send_list) join_send_list();
+	#endif
+}
+
+void Connection::send_latest(void const *head, size_t head_size, SharedBytes const &body) {
+	assert(body);
+	assert(head_size <= SharedSend::MaxHead);
+	#ifdef _WIN32
+	bool copy = true;
+	#else
+	bool copy = (datagram != nullptr);
+	#endif
+	if (copy) {
+		send_raw(head, head_size);
+		send_shared(body);
+		return;
+	}
+	//drop anything this replaces (the front one may be partly sent, so it stays):
+	for (auto s = shared_sends.begin(); s != shared_sends.end(); /* later */) {
+		if (s->latest && s->offset == 0) {
+			shared_queued -= s->size();
+			superseded += 1;
+			s = shared_sends.erase(s);
+		} else {
+			++s;
+		}
+	}
+	shared_sends.emplace_back();
+	SharedSend &send = shared_sends.back();
+	send.at = send_buffer_sent + send_buffer.size();
+	std::memcpy(send.head, head, head_size);
+	send.head_size = uint8_t(head_size);
+	send.latest = true;
+	send.bytes = body;
+	shared_queued += send.size();
+	if (send_list && !on_send_list) join_send_list();
+}
+
+void Connection::join_send_list() {
+	assert(send_list && !on_send_list);
+	send_list_prev = nullptr;
+	send_list_next = send_list->first;
+	if (send_list_next) send_list_next->send_list_prev = this;
+	send_list->first = this;
+	on_send_list = true;
+}
+
+void Connection::leave_send_list() {
+	if (!on_send_list) return;
+	if (send_list_prev) send_list_prev->send_list_next = send_list_next;
+	else send_list->first = send_list_next;
+	if (send_list_next) send_list_next->send_list_prev = send_list_prev;
+	send_list_prev = send_list_next = nullptr;
+	on_send_list = false;
+}
+
+Connection::~Connection() {
+	leave_send_list();
+}
+
+static void send_goodbye(Connection &c); //(defined with the rest of the UDP transport, below)
+#ifdef __linux__
+static size_t write_ring(Connection &c, struct iovec const *pieces, size_t count); //(defined with the rest of the shared-memory transport, below)
+#endif
+
 void Connection::close() {
 	if (socket != InvalidSocket) {
-		::closesocket(socket);
+		if (datagram) send_goodbye(*this); //(best effort; otherwise the peer will time out)
+		//server-side UDP connections share the server's socket, so leave that open:
+		if (!datagram || datagram->address.empty()) ::closesocket(socket);
 		socket = InvalidSocket;
 	}
 }
 
 //---------------------------------
-//Polling helper used by both server and client:
+//Socket helpers used by both polling back-ends:
+
+static Connection *add_connection(char const *where, std::list< Connection > &connections, std::function< void(Connection *, Connection::Event event) > const &on_event, Socket got);
+
+//accept a pending connection on listen_socket (returns nullptr if there wasn't one):
+static Connection *accept_connection(
+	char const *where,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	Socket listen_socket) {
+
+	Socket got = accept(listen_socket, NULL, NULL);
+	if (got == InvalidSocket) {
+		//oh well.
+		return nullptr;
+	}
+	#ifdef _WIN32
+	unsigned long one = 1;
+	if (0 != ioctlsocket(got, FIONBIO, &one)) {
+		::closesocket(got);
+		return nullptr;
+	}
+	#endif
+	return add_connection(where, connections, on_event, got);
+}
+
+//add a connection for newly-accepted socket 'got':
+static Connection *add_connection(
+	char const *where,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	Socket got) {
+
+	#ifdef TCP_NOTSENT_LOWAT
+	//don't let the kernel take more than a little data the peer hasn't been sent yet, so a backlog builds up in the
+	// connection's own queue -- where newer state can replace it (see Connection::send_latest) -- rather than in the socket:
+	int low_water = 16384;
+	setsockopt(got, IPPROTO_TCP, TCP_NOTSENT_LOWAT, reinterpret_cast< char const * >(&low_water), sizeof(low_water));
+	#endif
+	connections.emplace_back();
+	connections.back().socket = got;
+	std::cerr << "[" << where << "] client connected on " << connections.back().socket << "." << std::endl; //INFO
+	if (on_event) on_event(&connections.back(), Connection::OnOpen);
+	return &connections.back();
+}
+
+//read everything currently available on c's socket into c.recv_buffer (closes c on error or end-of-stream):
+static void recv_available(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	const uint32_t BufferSize = 20000; //(most that is read per recv() call)
+
+	while (true) { //read until more data left to read
+		//read straight into the end of recv_buffer:
+		char *buffer = reinterpret_cast< char * >(c.recv_buffer.prepare(BufferSize));
+		ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~ but no data
+			break;
+		} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
+			//~problem~ so remove connection
+			if (ret == 0) {
+				std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
+			} else if (ret < 0) {
+				std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
+			} else {
+				std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			break;
+		} else { //ret > 0
+			c.recv_buffer.commit(size_t(ret));
+			if (on_event) on_event(&c, Connection::OnRecv);
+			if (c.socket == InvalidSocket) break; //(closed by the event handler)
+			if (ret < BufferSize) break; //ran out of data before buffer: no more data left to read
+		}
+	}
+}
+
+//send as much queued data (send_buffer and shared_sends) as the socket will take (closes c on error):
+// returns false if the socket couldn't take any more data
+static bool send_pending(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	#ifdef _WIN32
+	assert(c.shared_sends.empty()); //(send_shared copies on windows)
+	size_t total = c.send_buffer.size();
+	ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), int(c.send_buffer.size()), MSG_DONTWAIT);
+	#else
+	//gather everything queued, in order -- send_buffer bytes up to each shared range, then that range:
+	const size_t MaxPieces = 64;
+	struct iovec pieces[MaxPieces];
+	size_t count = 0;
+	size_t total = 0;
+	auto add = [&](void const *data, size_t size) {
+		if (size == 0) return;
+		assert(count < MaxPieces);
+		pieces[count].iov_base = const_cast< void * >(data);
+		pieces[count].iov_len = size;
+		count += 1;
+		total += size;
+	};
+	size_t buffer_at = 0; //send_buffer bytes gathered so far
+	bool gathered_all = true;
+	for (auto const &shared : c.shared_sends) {
+		if (count + 3 > MaxPieces) {
+			gathered_all = false; //(rest goes next time)
+			break;
+		}
+		size_t before = size_t(shared.at - c.send_buffer_sent);
+		add(c.send_buffer.data() + buffer_at, before - buffer_at);
+		buffer_at = before;
+		size_t head_at = std::min(shared.offset, size_t(shared.head_size));
+		add(shared.head + head_at, shared.head_size - head_at);
+		size_t bytes_at = shared.offset - head_at;
+		add(shared.bytes->data() + bytes_at, shared.bytes->size() - bytes_at);
+	}
+	if (gathered_all) {
+		add(c.send_buffer.data() + buffer_at, c.send_buffer.size() - buffer_at);
+	}
+
+	ssize_t ret = 0;
+	#ifdef __linux__
+	if (c.shared_memory) {
+		ret = ssize_t(write_ring(c, pieces, count));
+		if (ret == 0) return false; //(ring is full -- or the server hasn't set it up yet -- so wait for the next poll)
+	}
+	#endif
+	if (!c.shared_memory) {
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = pieces;
+		message.msg_iovlen = count;
+		ret = sendmsg(c.socket, &message, MSG_DONTWAIT);
+	}
+	#endif 
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		//~no problem~, but don't keep trying
+		return false;
+	} else if (ret <= 0 || ret > (ssize_t)total) {
+		if (ret < 0) {
+			std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
+		} else { assert(ret == 0 || ret > (ssize_t)total);
+			std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << total << "], disconnecting." << std::endl;
+		}
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
+	} else { //ret seems reasonable
+		//drop sent bytes from the queues, in the same order they were gathered:
+		size_t left = size_t(ret);
+		while (left > 0) {
+			size_t before = (c.shared_sends.empty() ? c.send_buffer.size() : size_t(c.shared_sends.front().at - c.send_buffer_sent));
+			size_t from_buffer = std::min(left, before);
+			c.send_buffer.consume(from_buffer);
+			c.send_buffer_sent += from_buffer;
+			left -= from_buffer;
+			if (left == 0) break;
+			assert(!c.shared_sends.empty());
+			auto &shared = c.shared_sends.front();
+			size_t from_shared = std::min(left, shared.size() - shared.offset);
+			shared.offset += from_shared;
+			c.shared_queued -= from_shared;
+			left -= from_shared;
+			if (shared.offset == shared.size()) c.shared_sends.pop_front();
+		}
+	}
+	return true;
+}
+
+//note how much is still waiting to go out on c after a poll's sends, and close c if it has fallen too far behind:
+static void check_backlog(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	size_t backlog = c.queued_bytes();
+	c.peak_backlog = std::max(c.peak_backlog, backlog);
+	if (backlog > c.send_limit) {
+		std::cerr << "[" << where << "] " << backlog << " bytes waiting to be sent is over the limit, disconnecting." << std::endl;
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
+	}
+}
+
+//---------------------------------
+//Polling helper used by both server and client (select() version):
 void poll_connections(
 	char const *where,
 	std::list< Connection > &connections,
 	std::function< void(Connection *, Connection::Event event) > const &on_event,
 	double timeout,
-	Socket listen_socket = InvalidSocket) {
+	Socket listen_socket = InvalidSocket,
+	int wake_fd = -1) {
+	TRACE_ZONE("poll_connections");
+
+	auto check_backlogs = [&]() {
+		for (auto &c : connections) {
+			if (c.socket != InvalidSocket && c.sending()) check_backlog(where, c, on_event);
+		}
+	};
 
 	fd_set read_fds, write_fds;
 	FD_ZERO(&read_fds);
@@ -72,13 +403,17 @@ void poll_connections(
 		max = std::max(max, int(listen_socket));
 		FD_SET(listen_socket, &read_fds);
 	}
+	if (wake_fd >= 0) {
+		max = std::max(max, wake_fd);
+		FD_SET(wake_fd, &read_fds);
+	}
 
 	//add each connection's socket to read (and possibly write) sets:
-	for (auto c : connections) {
+	for (auto const &c : connections) {
 		if (c.socket != InvalidSocket) {
 			max = std::max(max, int(c.socket));
 			FD_SET(c.socket, &read_fds);
-			if (!c.send_buffer.empty()) {
+			if (c.sending()) {
 				FD_SET(c.socket, &write_fds);
 			}
 		}
@@ -95,96 +430,1229 @@ void poll_connections(
 			std::cerr << "[" << where << "] Select returned an error; will attempt to read/write anyway." << std::endl;
 		} else if (ret == 0) {
 			//nothing to read or write.
+			check_backlogs();
 			return;
 		}
 	}
 
 	//add new connections as needed:
 	if (listen_socket != InvalidSocket && FD_ISSET(listen_socket, &read_fds)) {
-		Socket got = accept(listen_socket, NULL, NULL);
-		if (got == InvalidSocket) {
-			//oh well.
-		} else {
-			#ifdef _WIN32
-			unsigned long one = 1;
-			if (0 == ioctlsocket(got, FIONBIO, &one)) {
-			#else
-			{
-			#endif
-				connections.emplace_back();
-				connections.back().socket = got;
-				std::cerr << "[" << where << "] client connected on " << connections.back().socket << "." << std::endl; //INFO
-				if (on_event) on_event(&connections.back(), Connection::OnOpen);
-			}
-		}
+		accept_connection(where, connections, on_event, listen_socket);
 	}
 
-	const uint32_t BufferSize = 20000;
-	static thread_local char *buffer = new char[BufferSize];
-
 	//process requests:
 	for (auto &c : connections) {
 		//only read from valid sockets marked readable:
 		if (c.socket == InvalidSocket || !FD_ISSET(c.socket, &read_fds)) continue;
+		recv_available(where, c, on_event);
+	}
 
-		while (true) { //read until more data left to read
-			ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
-			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-				//~no problem~ but no data
-				break;
-			} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
-				//~problem~ so remove connection
-				if (ret == 0) {
-					std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
-				} else if (ret < 0) {
-					std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
+	//process responses:
+	for (auto &c : connections) {
+		//don't bother with connections unless they are valid, have something to send, and are marked writable:
+		if (c.socket == InvalidSocket || !c.sending() || !FD_ISSET(c.socket, &write_fds)) continue;
+		//(a socket that won't take everything just waits for the next poll; the others still get their turn)
+		send_pending(where, c, on_event);
+	}
+
+	check_backlogs();
+}
+
+#ifdef __linux__
+//---------------------------------
+//Polling helper used by both server and client (epoll version):
+// Sockets stay registered with 'epoll_fd' between calls, so the kernel only reports sockets that have something to do.
+// - connections are registered edge-triggered for reads, so each report is drained with recv_available();
+// - sends are only tried for connections on the Server's (or Client's) send_list, which each joins when it queues something;
+// - write interest (EPOLLOUT) is only registered while a connection has data the socket wouldn't take yet.
+
+//(epoll data.ptr for what isn't a connection -- besides the listen socket, whose data.ptr is nullptr)
+static char LocalListenMarker; //server's local_socket
+static char WakeMarker; //server's wake_pipe
+
+static void watch_writes(char const *where, int epoll_fd, Connection &c, bool watch) {
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (watch ? uint32_t(EPOLLOUT) : 0u);
+	event.data.ptr = &c;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.socket, &event) != 0) {
+		std::cerr << "[" << where << "] epoll_ctl(MOD) failed: " << strerror(errno) << std::endl;
+	}
+	c.watching_writes = watch;
+}
+
+static void register_connection(char const *where, int epoll_fd, Connection::SendList &send_list, Connection &c) {
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = &c;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.socket, &event) != 0) {
+		throw std::system_error(errno, std::system_category(), std::string("[") + where + "] failed to add socket to epoll set");
+	}
+	c.watching_writes = false;
+	c.send_list = &send_list;
+	if (c.sending() && !c.on_send_list) c.join_send_list(); //(e.g., queued by OnOpen, before registering)
+}
+
+//---------------------------------
+//Shared-memory transport (see Transport in Connection.hpp).
+//The client creates a memfd segment holding two single-producer, single-consumer byte rings:
+//  [SegmentHeader][Ring client-to-server][RingCapacity bytes][Ring server-to-client][RingCapacity bytes]
+//plus an eventfd to wake each side, then passes all three to the server over a unix socket
+//(in the abstract namespace, named for the server's port) as soon as it connects. The server takes
+//exactly those three descriptors, and only a segment of the expected size, sealed against resizing.
+//
+//A ring's 'tail' (written by its producer) and 'head' (written by its consumer) only ever grow, so
+//tail - head bytes are waiting. The consumer only needs waking if it had caught up: the producer
+//signals the eventfd if, after publishing 'tail', the consumer's 'head' is where the write began; the
+//consumer looks at 'tail' again after publishing 'head'. (Both sides fence in between, so at least one
+//of them sees the other's update.)
+
+namespace {
+	constexpr uint32_t SegmentMagic = 0x31526853; //"ShR1"
+	constexpr uint64_t RingCapacity = uint64_t(1) << 19; //bytes in each direction (must be a power of two)
+
+	struct SegmentHeader {
+		uint32_t magic;
+		uint32_t ring_capacity;
+	};
+	struct Ring {
+		alignas(64) std::atomic< uint64_t > tail; //bytes written so far
+		alignas(64) std::atomic< uint64_t > head; //bytes read so far
+		uint8_t *data() { return reinterpret_cast< uint8_t * >(this + 1); }
+	};
+	static_assert(std::atomic< uint64_t >::is_always_lock_free, "ring positions are shared between processes, so must be lock-free");
+	static_assert((RingCapacity & (RingCapacity - 1)) == 0, "ring capacity must be a power of two");
+
+	constexpr size_t ClientToServer = 64; //(offset of each ring in the segment)
+	constexpr size_t ServerToClient = ClientToServer + sizeof(Ring) + RingCapacity;
+	constexpr size_t SegmentSize = ServerToClient + sizeof(Ring) + RingCapacity;
+	//(sealed so the client can't shrink the segment out from under the server's mapping, which would SIGBUS it)
+	constexpr int SegmentSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+	Ring &ring_at(Connection::SharedMemory &s, size_t offset) {
+		assert(s.segment);
+		return *reinterpret_cast< Ring * >(reinterpret_cast< uint8_t * >(s.segment) + offset);
+	}
+
+	void wake(int eventfd) {
+		uint64_t one = 1;
+		ssize_t ret = write(eventfd, &one, sizeof(one));
+		(void)ret; //(can only fail if the counter is about to overflow, in which case the peer is awake anyway)
+	}
+
+	//address of the unix socket local clients of the server on 'port' connect to:
+	// (abstract namespace, so there's no file to clean up)
+	socklen_t local_address(std::string const &port, struct sockaddr_un *address) {
+		std::string name = "game-server:" + port;
+		memset(address, 0, sizeof(*address));
+		address->sun_family = AF_UNIX;
+		if (1 + name.size() > sizeof(address->sun_path)) {
+			throw std::runtime_error("Port name '" + port + "' is too long for a local socket address.");
+		}
+		memcpy(address->sun_path + 1, name.data(), name.size());
+		return socklen_t(offsetof(struct sockaddr_un, sun_path) + 1 + name.size());
+	}
+}
+
+Connection::SharedMemory::~SharedMemory() {
+	if (segment) munmap(segment, SegmentSize);
+	if (wake_in >= 0) ::close(wake_in);
+	if (wake_out >= 0) ::close(wake_out);
+}
+
+//copy as much of 'pieces' as fits into c's outgoing ring (returns bytes copied):
+static size_t write_ring(Connection &c, struct iovec const *pieces, size_t count) {
+	auto &s = *c.shared_memory;
+	if (!s.segment) return 0;
+	Ring &ring = ring_at(s, s.out);
+	uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+	uint64_t waiting = tail - ring.head.load(std::memory_order_acquire);
+	if (waiting >= RingCapacity) return 0; //(full -- or garbled by the peer, in which case the backlog limit closes c)
+
+	uint64_t at = tail;
+	uint64_t end = tail + (RingCapacity - waiting);
+	for (size_t p = 0; p < count && at < end; ++p) {
+		uint8_t const *src = reinterpret_cast< uint8_t const * >(pieces[p].iov_base);
+		size_t size = size_t(std::min< uint64_t >(pieces[p].iov_len, end - at));
+		size_t index = size_t(at & (RingCapacity - 1));
+		size_t first = std::min(size, size_t(RingCapacity - index));
+		std::memcpy(ring.data() + index, src, first);
+		std::memcpy(ring.data(), src + first, size - first);
+		at += size;
+	}
+
+	ring.tail.store(at, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (ring.head.load(std::memory_order_relaxed) == tail) wake(s.wake_out);
+	return size_t(at - tail);
+}
+
+//append everything waiting in c's incoming ring to c.recv_buffer (returns false if the ring is garbled):
+static bool read_ring(Connection &c, size_t *got) {
+	auto &s = *c.shared_memory;
+	Ring &ring = ring_at(s, s.in);
+	uint64_t head = ring.head.load(std::memory_order_relaxed);
+	*got = 0;
+	while (true) {
+		uint64_t tail = ring.tail.load(std::memory_order_acquire);
+		if (tail == head) return true;
+		if (tail - head > RingCapacity) return false;
+		size_t size = size_t(tail - head);
+		size_t index = size_t(head & (RingCapacity - 1));
+		size_t first = std::min(size, size_t(RingCapacity - index));
+		uint8_t *dst = c.recv_buffer.prepare(size);
+		std::memcpy(dst, ring.data() + index, first);
+		std::memcpy(dst + first, ring.data(), size - first);
+		c.recv_buffer.commit(size);
+		*got += size;
+		head = tail;
+		ring.head.store(head, std::memory_order_release);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+}
+
+//(client side) connect to the local server on 'port' and hand it a fresh segment and eventfds (throws on failure):
+static void connect_local(Connection &c, std::string const &port) {
+	struct sockaddr_un address;
+	socklen_t address_size = local_address(port, &address);
+
+	Socket s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (s == InvalidSocket) {
+		throw std::system_error(errno, std::system_category(), "failed to create local socket");
+	}
+	if (connect(s, reinterpret_cast< struct sockaddr const * >(&address), address_size) != 0) {
+		int error = errno;
+		::close(s);
+		throw std::system_error(error, std::system_category(), "failed to connect to a local server on port " + port);
+	}
+	c.socket = s; //(so a failure below can just close() c)
+	auto fail = [&](char const *what) {
+		int error = errno;
+		c.close();
+		c.shared_memory.reset();
+		throw std::system_error(error, std::system_category(), what);
+	};
+
+	c.shared_memory = std::make_unique< Connection::SharedMemory >();
+	auto &shared = *c.shared_memory;
+	int segment_fd = memfd_create("connection", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (segment_fd < 0) fail("failed to create shared memory");
+	if (ftruncate(segment_fd, SegmentSize) != 0) {
+		::close(segment_fd);
+		fail("failed to size shared memory");
+	}
+	if (fcntl(segment_fd, F_ADD_SEALS, SegmentSeals) != 0) {
+		::close(segment_fd);
+		fail("failed to seal shared memory");
+	}
+	void *segment = mmap(nullptr, SegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, segment_fd, 0);
+	if (segment == MAP_FAILED) {
+		::close(segment_fd);
+		fail("failed to map shared memory");
+	}
+	shared.segment = segment;
+	shared.in = ServerToClient;
+	shared.out = ClientToServer;
+	//(ftruncate zero-filled the segment; this just makes the header and rings official)
+	SegmentHeader *header = new (segment) SegmentHeader;
+	header->magic = SegmentMagic;
+	header->ring_capacity = uint32_t(RingCapacity);
+	for (size_t offset : {ClientToServer, ServerToClient}) {
+		Ring *ring = new (reinterpret_cast< uint8_t * >(segment) + offset) Ring;
+		ring->tail.store(0, std::memory_order_relaxed);
+		ring->head.store(0, std::memory_order_relaxed);
+	}
+
+	shared.wake_in = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	shared.wake_out = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (shared.wake_in < 0 || shared.wake_out < 0) {
+		::close(segment_fd);
+		fail("failed to create eventfd");
+	}
+
+	//send [segment, server's eventfd, client's eventfd] along with one (meaningless) byte:
+	int fds[3] = { segment_fd, shared.wake_out, shared.wake_in };
+	char byte = 0;
+	struct iovec piece;
+	piece.iov_base = &byte;
+	piece.iov_len = 1;
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+	memset(control, 0, sizeof(control));
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &piece;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	ssize_t ret = sendmsg(s, &message, MSG_NOSIGNAL);
+	::close(segment_fd); //(the mapping, and the server's copy of the fd, keep the memory around)
+	if (ret != 1) fail("failed to send shared memory to the server");
+
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+}
+
+//(server side) take the segment and eventfds a local client sends once it connects:
+// returns false if the handshake is bad or the client hung up first (if it just hasn't arrived yet, c.shared_memory->segment stays nullptr)
+static bool receive_segment(char const *where, int epoll_fd, Connection &c) {
+	int fds[3];
+	char byte;
+	struct iovec piece;
+	piece.iov_base = &byte;
+	piece.iov_len = 1;
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &piece;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	ssize_t ret = recvmsg(c.socket, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+	if (ret <= 0) {
+		std::cerr << "[" << where << "] local client left before sending its shared memory, disconnecting." << std::endl;
+		return false;
+	}
+
+	//collect the descriptors that came in (only SCM_RIGHTS messages carry them; the first std::size(fds) are kept
+	// and the rest closed right away, so nothing a misbehaving peer sends leaks or overruns 'fds'):
+	size_t fd_count = 0;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+		if (cmsg->cmsg_len < CMSG_LEN(0)) continue;
+		char const *data = reinterpret_cast< char const * >(CMSG_DATA(cmsg));
+		size_t count = std::min(
+			size_t(cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int),
+			size_t(control + message.msg_controllen - data) / sizeof(int) //(never read past what was received)
+		);
+		for (size_t i = 0; i < count; ++i) {
+			int fd;
+			memcpy(&fd, data + i * sizeof(int), sizeof(int));
+			if (fd_count < std::size(fds)) fds[fd_count] = fd;
+			else ::close(fd);
+			fd_count += 1;
+		}
+	}
+	auto &shared = *c.shared_memory;
+	if (fd_count == std::size(fds) && !(message.msg_flags & MSG_CTRUNC)) {
+		//(eventfds first, so the destructor closes them whatever happens next)
+		shared.wake_in = fds[1];
+		shared.wake_out = fds[2];
+		struct stat info;
+		int seals = fcntl(fds[0], F_GET_SEALS);
+		if (fstat(fds[0], &info) == 0 && size_t(info.st_size) == SegmentSize
+		 && seals >= 0 && (seals & SegmentSeals) == SegmentSeals) {
+			void *segment = mmap(nullptr, SegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+			if (segment != MAP_FAILED) {
+				SegmentHeader const &header = *reinterpret_cast< SegmentHeader const * >(segment);
+				if (header.magic == SegmentMagic && header.ring_capacity == RingCapacity) {
+					shared.segment = segment;
 				} else {
-					std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
+					munmap(segment, SegmentSize);
+				}
+			}
+		}
+		::close(fds[0]);
+	} else {
+		for (size_t i = 0; i < fd_count && i < std::size(fds); ++i) ::close(fds[i]);
+	}
+	if (!shared.segment) {
+		std::cerr << "[" << where << "] local client sent something other than a shared memory segment, disconnecting." << std::endl;
+		return false;
+	}
+	shared.in = ClientToServer;
+	shared.out = ServerToClient;
+
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = &c;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, shared.wake_in, &event) != 0) {
+		std::cerr << "[" << where << "] failed to add eventfd to epoll set: " << strerror(errno) << ", disconnecting." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//read whatever a shared-memory connection's peer has sent, and notice if it has gone away:
+// ('events' is what epoll reported, for either the connection's socket or its eventfd)
+static void recv_local(
+	char const *where,
+	int epoll_fd,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	uint32_t events) {
+
+	auto &shared = *c.shared_memory;
+	if (!shared.segment && !receive_segment(where, epoll_fd, c)) {
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
+		return;
+	}
+	if (shared.segment) {
+		//reset the eventfd *before* looking at the ring, so a wakeup for anything written after this isn't lost:
+		uint64_t count;
+		ssize_t ret = read(shared.wake_in, &count, sizeof(count));
+		(void)ret; //(EAGAIN just means nobody needed to wake us)
+		size_t got = 0;
+		if (!read_ring(c, &got)) {
+			std::cerr << "[" << where << "] shared memory ring is garbled, disconnecting." << std::endl;
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			return;
+		}
+		if (got > 0 && on_event) on_event(&c, Connection::OnRecv);
+		if (c.socket == InvalidSocket) return; //(closed by the event handler)
+	}
+	if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+		std::cerr << "[" << where << "] local peer closed, disconnecting." << std::endl;
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
+	}
+}
+
+//accept every local client waiting on local_socket:
+static void accept_local(
+	char const *where,
+	int epoll_fd,
+	std::list< Connection > &connections,
+	Connection::SendList &send_list,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	Socket local_socket) {
+
+	while (true) {
+		Socket got = accept4(local_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (got == InvalidSocket) break;
+		connections.emplace_back();
+		Connection &c = connections.back();
+		c.socket = got;
+		c.shared_memory = std::make_unique< Connection::SharedMemory >();
+		register_connection(where, epoll_fd, send_list, c);
+		std::cerr << "[" << where << "] local client connected on " << c.socket << " (shared memory)." << std::endl; //INFO
+		//(anything sent before the segment arrives just waits in the send queue)
+		if (on_event) on_event(&c, Connection::OnOpen);
+		if (c.socket != InvalidSocket) recv_local(where, epoll_fd, c, on_event, 0);
+	}
+}
+
+void poll_connections_epoll(
+	char const *where,
+	int epoll_fd,
+	std::list< Connection > &connections,
+	Connection::SendList &send_list,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	Socket listen_socket = InvalidSocket,
+	Socket local_socket = InvalidSocket) {
+	TRACE_ZONE("poll_connections_epoll");
+
+	//try to send newly-queued data right away; only wait for writability if the socket is backed up:
+	// (only connections that queued something since their last try are on send_list, so idle connections cost nothing)
+	// (a shared-memory connection whose ring is full stays on the list to try again next poll, since there's nothing to wait on)
+	for (Connection *next = send_list.first; next; /* later */) {
+		Connection &c = *next;
+		next = c.send_list_next;
+		if (c.socket != InvalidSocket && c.sending()) {
+			if (!c.watching_writes) {
+				send_pending(where, c, on_event);
+				if (c.socket != InvalidSocket && c.sending() && !c.shared_memory) {
+					watch_writes(where, epoll_fd, c, true);
 				}
+			}
+			if (c.socket != InvalidSocket && c.sending()) check_backlog(where, c, on_event);
+		}
+		if (c.socket == InvalidSocket || !c.sending() || c.watching_writes) c.leave_send_list();
+	}
+
+	const int MaxEvents = 256;
+	struct epoll_event events[MaxEvents];
+	int count;
+	{ //wait (until timeout) for sockets' data to become available:
+		//(round up to whole milliseconds so short waits don't turn into busy loops)
+		int timeout_ms = int(std::ceil(std::max(0.0, timeout) * 1000.0));
+		count = epoll_wait(epoll_fd, events, MaxEvents, timeout_ms);
+		if (count < 0) {
+			if (errno != EINTR) {
+				std::cerr << "[" << where << "] epoll_wait returned an error: " << strerror(errno) << std::endl;
+			}
+			return;
+		}
+	}
+
+	//process requests (and new connections):
+	for (int i = 0; i < count; ++i) {
+		if (events[i].data.ptr == nullptr) {
+			//listen socket (level-triggered and non-blocking, so accept everything that's waiting):
+			assert(listen_socket != InvalidSocket);
+			while (Connection *c = accept_connection(where, connections, on_event, listen_socket)) {
+				if (c->socket != InvalidSocket) register_connection(where, epoll_fd, send_list, *c);
+			}
+			continue;
+		}
+		if (events[i].data.ptr == &LocalListenMarker) {
+			assert(local_socket != InvalidSocket);
+			accept_local(where, epoll_fd, connections, send_list, on_event, local_socket);
+			continue;
+		}
+		if (events[i].data.ptr == &WakeMarker) continue; //(just here to end the wait; Server::poll empties the pipe)
+		Connection &c = *reinterpret_cast< Connection * >(events[i].data.ptr);
+		//(skip sockets closed earlier in this poll)
+		if (c.socket == InvalidSocket) continue;
+		if (c.shared_memory) {
+			recv_local(where, epoll_fd, c, on_event, events[i].events);
+		} else if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			recv_available(where, c, on_event);
+		}
+	}
+
+	//process responses:
+	for (int i = 0; i < count; ++i) {
+		if (events[i].data.ptr == nullptr || !(events[i].events & EPOLLOUT)) continue;
+		Connection &c = *reinterpret_cast< Connection * >(events[i].data.ptr);
+		if (c.socket == InvalidSocket || !c.watching_writes) continue;
+		while (c.sending() && send_pending(where, c, on_event)) {
+			if (c.socket == InvalidSocket) break;
+		}
+		if (c.socket != InvalidSocket && !c.sending()) {
+			watch_writes(where, epoll_fd, c, false);
+		}
+	}
+}
+#endif
+
+#ifdef CONNECTION_HAS_URING
+//---------------------------------
+//Polling helper used by both server and client (io_uring version):
+// - the listen socket has one multishot accept, and each connection one multishot recv, that keep completing until
+//   something stops them (e.g., running out of buffers), and are set up again on the next poll;
+// - received bytes land in buffers handed to the kernel ahead of time ("provided buffers"); they are copied to
+//   recv_buffer, and the buffers are handed back (in runs, so usually with a few submissions per poll);
+// - each poll takes everything queued on each connection without a send in flight into one sendmsg, and submits
+//   them all with the same io_uring_enter() that waits for completions.
+//Operations are tagged (user_data) with [connection's uring_id << 8 | kind], and state needed until they complete
+// lives in IoUring::entries rather than the Connection, so completions for connections that are gone are harmless.
+
+namespace {
+	enum UringKind : uint64_t {
+		UringIgnore = 0, //(cancellations)
+		UringAccept = 1,
+		UringWake = 2,
+		UringRecv = 3,
+		UringSend = 4,
+	};
+	constexpr uint32_t UringEntries = 4096; //submission queue size (the completion queue is four times this)
+	constexpr uint32_t RecvBufferCount = 1024; //provided buffers (must be a power of two)
+	constexpr uint32_t RecvBufferSize = 4096;
+	constexpr size_t MaxSendPieces = 64;
+}
+
+struct IoUring {
+	~IoUring();
+
+	int fd = -1;
+	//submission queue:
+	uint32_t *sq_head = nullptr, *sq_tail = nullptr, *sq_array = nullptr;
+	uint32_t sq_mask = 0, sq_entries = 0;
+	uint32_t sq_queued = 0; //local tail (published to *sq_tail when submitting)
+	struct io_uring_sqe *sqes = nullptr;
+	//completion queue:
+	uint32_t *cq_head = nullptr, *cq_tail = nullptr;
+	uint32_t cq_mask = 0;
+	struct io_uring_cqe *cqes = nullptr;
+	//mappings:
+	void *rings = MAP_FAILED;
+	size_t rings_size = 0;
+	void *sqe_map = MAP_FAILED;
+	size_t sqe_map_size = 0;
+
+	//provided receive buffers (buffer group 0):
+	std::vector< uint8_t > buffers; //(RecvBufferCount * RecvBufferSize bytes)
+	std::vector< uint16_t > returned; //ids of buffers done with since they were last handed back
+
+	bool accept_armed = false;
+	bool wake_armed = false;
+
+	//what each connection has in flight:
+	struct Entry {
+		Connection *connection = nullptr; //(nullptr once the connection has closed)
+		bool receiving = false; //multishot recv armed
+		bool sending = false; //sendmsg in flight
+		std::vector< uint8_t > staging; //copies of the send_buffer bytes and heads being sent
+		std::vector< SharedBytes > holds; //shared bytes being sent (kept alive until the send completes)
+		std::vector< struct iovec > pieces; //what is being sent, in order (pointing into the above)
+		struct msghdr message;
+		size_t total = 0; //bytes left to send in 'pieces'
+	};
+	std::unordered_map< uint64_t, Entry > entries; //(by connection uring_id; node-based, so msghdr addresses are stable)
+	uint64_t next_id = 1;
+};
+
+IoUring::~IoUring() {
+	if (sqe_map != MAP_FAILED) munmap(sqe_map, sqe_map_size);
+	if (rings != MAP_FAILED) munmap(rings, rings_size);
+	if (fd >= 0) ::close(fd);
+}
+
+//set up an io_uring (or explain why not and return nullptr, so the caller can fall back to epoll):
+static std::unique_ptr< IoUring > create_uring(char const *where) {
+	auto unavailable = [&](std::string const &why) {
+		std::cout << "[" << where << "] io_uring unavailable (" << why << "); using epoll instead." << std::endl;
+		return nullptr;
+	};
+
+	{ //multishot recv needs linux 6.0:
+		struct utsname info;
+		int major = 0, minor = 0;
+		if (uname(&info) != 0 || sscanf(info.release, "%d.%d", &major, &minor) != 2 || major < 6) {
+			return unavailable("needs linux 6.0 or newer");
+		}
+	}
+
+	auto u = std::make_unique< IoUring >();
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = 4 * UringEntries;
+	u->fd = int(syscall(__NR_io_uring_setup, UringEntries, &params));
+	if (u->fd < 0 && errno == EINVAL) {
+		//(COOP_TASKRUN is only a hint, so try without it)
+		params.flags &= ~IORING_SETUP_COOP_TASKRUN;
+		u->fd = int(syscall(__NR_io_uring_setup, UringEntries, &params));
+	}
+	if (u->fd < 0) return unavailable(std::string("io_uring_setup: ") + strerror(errno));
+	uint32_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+	if ((params.features & needed) != needed) return unavailable("kernel lacks needed io_uring features");
+
+	u->rings_size = std::max(
+		params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+		params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe)
+	);
+	u->rings = mmap(nullptr, u->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	u->sqe_map_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqe_map = mmap(nullptr, u->sqe_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->rings == MAP_FAILED || u->sqe_map == MAP_FAILED) return unavailable(std::string("mmap: ") + strerror(errno));
+	uint8_t *rings = reinterpret_cast< uint8_t * >(u->rings);
+	u->sq_head = reinterpret_cast< uint32_t * >(rings + params.sq_off.head);
+	u->sq_tail = reinterpret_cast< uint32_t * >(rings + params.sq_off.tail);
+	u->sq_array = reinterpret_cast< uint32_t * >(rings + params.sq_off.array);
+	u->sq_mask = *reinterpret_cast< uint32_t * >(rings + params.sq_off.ring_mask);
+	u->sq_entries = params.sq_entries;
+	u->sq_queued = *u->sq_tail;
+	u->sqes = reinterpret_cast< struct io_uring_sqe * >(u->sqe_map);
+	u->cq_head = reinterpret_cast< uint32_t * >(rings + params.cq_off.head);
+	u->cq_tail = reinterpret_cast< uint32_t * >(rings + params.cq_off.tail);
+	u->cq_mask = *reinterpret_cast< uint32_t * >(rings + params.cq_off.ring_mask);
+	u->cqes = reinterpret_cast< struct io_uring_cqe * >(rings + params.cq_off.cqes);
+
+	//hand the kernel buffers to receive into:
+	u->buffers.resize(size_t(RecvBufferCount) * RecvBufferSize);
+	u->returned.reserve(RecvBufferCount);
+	for (uint32_t b = 0; b < RecvBufferCount; ++b) u->returned.emplace_back(uint16_t(b));
+
+	return u;
+}
+
+//submit what's queued and (if 'wait') wait until at least one completion is ready or 'timeout' passes:
+static void uring_enter(char const *where, IoUring &u, bool wait, double timeout) {
+	__atomic_store_n(u.sq_tail, u.sq_queued, __ATOMIC_RELEASE);
+	uint32_t to_submit = u.sq_queued - __atomic_load_n(u.sq_head, __ATOMIC_ACQUIRE);
+	if (to_submit == 0 && !wait) return;
+
+	struct __kernel_timespec ts;
+	ts.tv_sec = int64_t(std::floor(timeout));
+	ts.tv_nsec = int64_t((timeout - std::floor(timeout)) * 1e9);
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = uint64_t(uintptr_t(&ts));
+	uint32_t flags = IORING_ENTER_EXT_ARG | (wait ? IORING_ENTER_GETEVENTS : 0);
+	long ret = syscall(__NR_io_uring_enter, u.fd, to_submit, (wait ? 1 : 0), flags, &arg, sizeof(arg));
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+		std::cerr << "[" << where << "] io_uring_enter returned an error: " << strerror(errno) << std::endl;
+	}
+}
+
+//next free submission queue entry (cleared, with 'user_data' set):
+static struct io_uring_sqe *uring_sqe(char const *where, IoUring &u, uint64_t user_data) {
+	if (u.sq_queued - __atomic_load_n(u.sq_head, __ATOMIC_ACQUIRE) == u.sq_entries) {
+		uring_enter(where, u, false, 0.0); //(full, so submit what's there to make room)
+		if (u.sq_queued - __atomic_load_n(u.sq_head, __ATOMIC_ACQUIRE) == u.sq_entries) {
+			throw std::runtime_error(std::string("[") + where + "] io_uring submission queue is stuck full.");
+		}
+	}
+	uint32_t index = u.sq_queued & u.sq_mask;
+	struct io_uring_sqe *sqe = &u.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = user_data;
+	u.sq_array[index] = index;
+	u.sq_queued += 1;
+	return sqe;
+}
+
+//take everything queued on c (up to MaxSendPieces pieces) into e, and start sending it:
+static void uring_send(char const *where, IoUring &u, Connection &c, IoUring::Entry &e) {
+	assert(!e.sending);
+	//copy per-connection bytes into 'staging' and hold on to shared ones, remembering the order:
+	struct Piece {
+		uint8_t const *data; //(shared bytes) or nullptr (staged at 'at')
+		size_t at, size;
+	};
+	std::vector< Piece > order;
+	e.staging.clear();
+	e.holds.clear();
+	auto stage = [&](uint8_t const *data, size_t size) {
+		if (size == 0) return;
+		if (!order.empty() && order.back().data == nullptr) {
+			order.back().size += size; //(adjacent staged bytes go out as one piece)
+		} else {
+			order.emplace_back(Piece{nullptr, e.staging.size(), size});
+		}
+		e.staging.insert(e.staging.end(), data, data + size);
+	};
+	size_t buffer_at = 0; //send_buffer bytes taken so far
+	while (!c.shared_sends.empty() && order.size() + 3 <= MaxSendPieces) {
+		auto &shared = c.shared_sends.front();
+		size_t before = size_t(shared.at - c.send_buffer_sent);
+		stage(c.send_buffer.data() + buffer_at, before - buffer_at);
+		buffer_at = before;
+		size_t head_at = std::min(shared.offset, size_t(shared.head_size));
+		stage(shared.head + head_at, shared.head_size - head_at);
+		size_t bytes_at = shared.offset - head_at;
+		if (bytes_at < shared.bytes->size()) {
+			order.emplace_back(Piece{shared.bytes->data() + bytes_at, 0, shared.bytes->size() - bytes_at});
+			e.holds.emplace_back(shared.bytes);
+		}
+		c.shared_queued -= shared.size() - shared.offset;
+		c.shared_sends.pop_front();
+	}
+	if (c.shared_sends.empty()) {
+		stage(c.send_buffer.data() + buffer_at, c.send_buffer.size() - buffer_at);
+		buffer_at = c.send_buffer.size();
+	}
+	c.send_buffer.consume(buffer_at);
+	c.send_buffer_sent += buffer_at;
+
+	e.pieces.clear();
+	e.total = 0;
+	for (auto const &piece : order) {
+		struct iovec iov;
+		iov.iov_base = const_cast< uint8_t * >(piece.data ? piece.data : e.staging.data() + piece.at);
+		iov.iov_len = piece.size;
+		e.pieces.emplace_back(iov);
+		e.total += piece.size;
+	}
+	if (e.total == 0) return;
+
+	memset(&e.message, 0, sizeof(e.message));
+	e.message.msg_iov = e.pieces.data();
+	e.message.msg_iovlen = e.pieces.size();
+	struct io_uring_sqe *sqe = uring_sqe(where, u, (c.uring_id << 8) | UringSend);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = c.socket;
+	sqe->addr = uint64_t(uintptr_t(&e.message));
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	e.sending = true;
+}
+
+static void poll_connections_uring(
+	char const *where,
+	IoUring &u,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	Socket listen_socket = InvalidSocket,
+	int wake_fd = -1) {
+	TRACE_ZONE("poll_connections_uring");
+
+	//hand back receive buffers (each run of consecutive ids takes one submission):
+	std::sort(u.returned.begin(), u.returned.end());
+	for (size_t begin = 0, end = 0; begin < u.returned.size(); begin = end) {
+		end = begin + 1;
+		while (end < u.returned.size() && u.returned[end] == u.returned[end - 1] + 1) ++end;
+		struct io_uring_sqe *sqe = uring_sqe(where, u, UringIgnore);
+		sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+		sqe->fd = int(end - begin); //(number of buffers)
+		sqe->addr = uint64_t(uintptr_t(u.buffers.data() + size_t(u.returned[begin]) * RecvBufferSize));
+		sqe->len = RecvBufferSize;
+		sqe->off = u.returned[begin]; //(first buffer id)
+		sqe->buf_group = 0;
+	}
+	u.returned.clear();
+
+	//set up whatever isn't running, and start sending what's queued:
+	if (listen_socket != InvalidSocket && !u.accept_armed) {
+		struct io_uring_sqe *sqe = uring_sqe(where, u, UringAccept);
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = listen_socket;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		u.accept_armed = true;
+	}
+	if (wake_fd >= 0 && !u.wake_armed) {
+		struct io_uring_sqe *sqe = uring_sqe(where, u, UringWake);
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = wake_fd;
+		sqe->poll32_events = POLLIN;
+		sqe->len = IORING_POLL_ADD_MULTI;
+		u.wake_armed = true;
+	}
+	for (auto &c : connections) {
+		if (c.socket == InvalidSocket) continue;
+		if (c.uring_id == 0) {
+			c.uring_id = u.next_id++;
+			u.entries[c.uring_id].connection = &c;
+		}
+		IoUring::Entry &e = u.entries.at(c.uring_id);
+		if (!e.receiving) {
+			struct io_uring_sqe *sqe = uring_sqe(where, u, (c.uring_id << 8) | UringRecv);
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = c.socket;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = 0;
+			e.receiving = true;
+		}
+		if (!e.sending && c.sending()) uring_send(where, u, c, e);
+		if (c.sending()) check_backlog(where, c, on_event);
+	}
+
+	//submit all that, and wait (until timeout) for something to happen:
+	uring_enter(where, u, (timeout > 0.0), std::max(0.0, timeout));
+
+	//handle completions:
+	uint32_t head = *u.cq_head;
+	uint32_t tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head) {
+		struct io_uring_cqe cqe = u.cqes[head & u.cq_mask];
+		bool more = (cqe.flags & IORING_CQE_F_MORE);
+		uint64_t kind = cqe.user_data & 0xff;
+		if (kind == UringAccept) {
+			if (!more) u.accept_armed = false;
+			if (cqe.res >= 0) {
+				add_connection(where, connections, on_event, Socket(cqe.res));
+			} else if (cqe.res != -ECANCELED) {
+				std::cerr << "[" << where << "] accept failed: " << strerror(-cqe.res) << std::endl;
+			}
+			continue;
+		}
+		if (kind == UringWake) {
+			if (!more) u.wake_armed = false;
+			continue; //(Server::poll empties the pipe)
+		}
+		if (kind != UringRecv && kind != UringSend) continue;
+
+		auto f = u.entries.find(cqe.user_data >> 8);
+		if (f == u.entries.end()) continue;
+		IoUring::Entry &e = f->second;
+		Connection *c = (e.connection && e.connection->socket != InvalidSocket ? e.connection : nullptr);
+		if (kind == UringRecv) {
+			if (!more) e.receiving = false;
+			uint8_t const *data = nullptr;
+			uint16_t bid = 0;
+			if (cqe.flags & IORING_CQE_F_BUFFER) {
+				bid = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+				data = u.buffers.data() + size_t(bid) * RecvBufferSize;
+			}
+			if (c && cqe.res > 0 && data) {
+				c->recv_buffer.append(data, size_t(cqe.res));
+				if (on_event) on_event(c, Connection::OnRecv);
+			} else if (c && cqe.res == 0) {
+				std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
+				c->close();
+				if (on_event) on_event(c, Connection::OnClose);
+			} else if (c && cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+				//(ENOBUFS: ran out of provided buffers; the recv is just set up again next poll)
+				std::cerr << "[" << where << "] recv() returned error " << -cqe.res << "(" << strerror(-cqe.res) << "), disconnecting." << std::endl;
+				c->close();
+				if (on_event) on_event(c, Connection::OnClose);
+			}
+			if (data) u.returned.emplace_back(bid);
+		} else { assert(kind == UringSend);
+			e.sending = false;
+			if (cqe.res >= 0 && size_t(cqe.res) < e.total && c) {
+				//partly sent; send the rest:
+				size_t left = size_t(cqe.res);
+				size_t p = 0;
+				while (left >= e.pieces[p].iov_len) left -= e.pieces[p++].iov_len;
+				e.pieces.erase(e.pieces.begin(), e.pieces.begin() + p);
+				e.pieces[0].iov_base = reinterpret_cast< uint8_t * >(e.pieces[0].iov_base) + left;
+				e.pieces[0].iov_len -= left;
+				e.total -= size_t(cqe.res);
+				e.message.msg_iov = e.pieces.data();
+				e.message.msg_iovlen = e.pieces.size();
+				struct io_uring_sqe *sqe = uring_sqe(where, u, cqe.user_data);
+				sqe->opcode = IORING_OP_SENDMSG;
+				sqe->fd = c->socket;
+				sqe->addr = uint64_t(uintptr_t(&e.message));
+				sqe->len = 1;
+				sqe->msg_flags = MSG_NOSIGNAL;
+				e.sending = true;
+			} else {
+				if (cqe.res < 0 && cqe.res != -ECANCELED && c) {
+					std::cerr << "[" << where << "] send() returned error " << -cqe.res << ", disconnecting." << std::endl;
+					c->close();
+					if (on_event) on_event(c, Connection::OnClose);
+				}
+				e.staging.clear();
+				e.holds.clear();
+				e.pieces.clear();
+				e.total = 0;
+			}
+		}
+		if (!e.connection && !e.receiving && !e.sending) u.entries.erase(f);
+	}
+	__atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+
+	//let go of closed connections, cancelling what they have in flight (so the socket really closes, and nothing
+	// completes into a Connection that's about to be reaped):
+	bool cancelled = false;
+	for (auto &c : connections) {
+		if (c.socket != InvalidSocket || c.uring_id == 0) continue;
+		auto f = u.entries.find(c.uring_id);
+		if (f != u.entries.end()) {
+			IoUring::Entry &e = f->second;
+			e.connection = nullptr;
+			for (auto [busy, kind] : { std::make_pair(e.receiving, UringRecv), std::make_pair(e.sending, UringSend) }) {
+				if (!busy) continue;
+				struct io_uring_sqe *sqe = uring_sqe(where, u, UringIgnore);
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->addr = (c.uring_id << 8) | kind;
+				cancelled = true;
+			}
+			if (!e.receiving && !e.sending) u.entries.erase(f);
+		}
+		c.uring_id = 0;
+	}
+	if (cancelled) uring_enter(where, u, false, 0.0);
+}
+#else
+struct IoUring { };
+#endif
+
+//---------------------------------
+//UDP transport (see Transport in Connection.hpp).
+//Every packet starts with [u32 magic][u8 kind][u32 session], then, by kind:
+// - Hello (client to server, repeated until answered) / Welcome (server's answer): nothing more;
+// - Data: [u32 sequence][u8 fragment index][u8 fragment count] then a piece of the payload
+//   (whole messages, split into fragments only if they don't fit in one packet);
+// - Keepalive (sent when nothing else has been for a while) / Goodbye (sent by close()): nothing more.
+
+namespace {
+	constexpr uint32_t DatagramMagic = 0x31506447; //"GdP1"
+	enum PacketKind : uint8_t {
+		Hello = 1,
+		Welcome = 2,
+		Data = 3,
+		Keepalive = 4,
+		Goodbye = 5,
+	};
+	constexpr size_t PacketHeaderSize = 4 + 1 + 4;
+	constexpr size_t DataHeaderSize = PacketHeaderSize + 4 + 1 + 1;
+	constexpr size_t MaxPacketSize = 1200; //(stays under common path MTUs, so IP never has to fragment a packet)
+	constexpr size_t MaxFragmentSize = MaxPacketSize - DataHeaderSize;
+	constexpr uint32_t MaxFragments = 255; //(so messages up to ~300k can be sent)
+
+	constexpr double KeepaliveInterval = 0.5; //seconds of sending nothing before a keepalive goes out
+	constexpr double DatagramTimeout = 5.0; //seconds of hearing nothing before a connection closes
+	constexpr double HelloInterval = 0.25; //seconds between handshake attempts
+
+	double steady_seconds() {
+		return std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	//wait (up to 'timeout' seconds) for 's' (or 'also', if given) to be readable:
+	bool wait_readable(Socket s, double timeout, int also = -1) {
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(s, &read_fds);
+		if (also >= 0) FD_SET(also, &read_fds);
+		struct timeval tv;
+		tv.tv_sec = std::lround(std::floor(timeout));
+		tv.tv_usec = std::lround((timeout - std::floor(timeout)) * 1e6);
+		return select(std::max(int(s), also) + 1, &read_fds, NULL, NULL, &tv) > 0;
+	}
+
+	size_t write_header(uint8_t *packet, PacketKind kind, uint32_t session) {
+		std::memcpy(packet, &DatagramMagic, 4);
+		packet[4] = kind;
+		std::memcpy(packet + 5, &session, 4);
+		return PacketHeaderSize;
+	}
+
+	//send one packet to c's peer (packets that don't fit in the socket's buffer are dropped, like any other lost packet):
+	void send_packet(char const *where, Connection &c, uint8_t const *packet, size_t size) {
+		assert(c.datagram);
+		ssize_t ret;
+		if (c.datagram->address.empty()) {
+			ret = send(c.socket, reinterpret_cast< char const * >(packet), int(size), MSG_DONTWAIT);
+		} else {
+			ret = sendto(c.socket, reinterpret_cast< char const * >(packet), int(size), MSG_DONTWAIT,
+				reinterpret_cast< struct sockaddr const * >(c.datagram->address.data()), socklen_t(c.datagram->address.size()));
+		}
+		if (ret < 0 && !(errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED)) {
+			std::cerr << "[" << where << "] sendto() returned error " << errno << " (" << strerror(errno) << "); dropping packet." << std::endl;
+		}
+		c.datagram->last_send = steady_seconds();
+	}
+
+	void send_control_packet(char const *where, Connection &c, PacketKind kind) {
+		uint8_t packet[PacketHeaderSize];
+		send_packet(where, c, packet, write_header(packet, kind, c.datagram->session));
+	}
+
+	//send 'size' bytes of whole messages as one packet (in fragments if needed):
+	void send_data_packet(char const *where, Connection &c, uint8_t const *data, size_t size) {
+		uint32_t count = uint32_t(std::max< size_t >(1, (size + MaxFragmentSize - 1) / MaxFragmentSize));
+		assert(count <= MaxFragments); //(send_datagrams checks)
+		uint32_t sequence = ++c.datagram->send_sequence;
+		uint8_t packet[MaxPacketSize];
+		for (uint32_t index = 0; index < count; ++index) {
+			size_t at = write_header(packet, Data, c.datagram->session);
+			std::memcpy(packet + at, &sequence, 4);
+			packet[at + 4] = uint8_t(index);
+			packet[at + 5] = uint8_t(count);
+			at += 6;
+			size_t begin = index * MaxFragmentSize;
+			size_t length = std::min(MaxFragmentSize, size - begin);
+			if (length) std::memcpy(packet + at, data + begin, length);
+			send_packet(where, c, packet, at + length);
+		}
+	}
+
+	//send everything in c's send_buffer, packing whole messages ([type][u24 size][...]) into packets:
+	// (a message too big for one packet can't be sent at all, and the peer would never learn it was lost -- so c is closed, as
+	//  when its backlog is over the limit)
+	void send_datagrams(
+		char const *where,
+		Connection &c,
+		std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+		assert(c.shared_sends.empty()); //(send_shared copies for UDP connections)
+		ByteQueue &buffer = c.send_buffer;
+		size_t packet_begin = 0;
+		size_t at = 0;
+		while (at < buffer.size()) {
+			size_t message_size = buffer.size() - at; //(a trailing partial header -- which shouldn't happen -- goes as-is)
+			if (message_size >= 4) {
+				message_size = std::min(message_size, 4 + ((size_t(buffer[at + 3]) << 16) | (size_t(buffer[at + 2]) << 8) | size_t(buffer[at + 1])));
+			}
+			if (message_size > MaxFragments * MaxFragmentSize) {
+				std::cerr << "[" << where << "] a " << message_size << "-byte message is too big to send as one packet, disconnecting." << std::endl;
+				buffer.clear();
 				c.close();
 				if (on_event) on_event(&c, Connection::OnClose);
-				break;
-			} else { //ret > 0
-				c.recv_buffer.insert(c.recv_buffer.end(), buffer, buffer + ret);
-				if (on_event) on_event(&c, Connection::OnRecv);
-				if (ret < BufferSize) break; //ran out of data before buffer: no more data left to read
+				return;
+			}
+			//start a new packet if this message won't fit in what's left of the current one:
+			if (at > packet_begin && (at + message_size) - packet_begin > MaxFragmentSize) {
+				send_data_packet(where, c, buffer.data() + packet_begin, at - packet_begin);
+				packet_begin = at;
 			}
+			at += message_size;
 		}
+		if (at > packet_begin) {
+			send_data_packet(where, c, buffer.data() + packet_begin, at - packet_begin);
+		}
+		buffer.clear();
 	}
 
-	//process responses:
+	//handle one Data packet's payload (returns true if a whole, fresh packet's worth of messages was appended to recv_buffer):
+	bool recv_data_packet(Connection &c, uint8_t const *data, size_t size) {
+		auto &d = *c.datagram;
+		if (size < 6) return false;
+		uint32_t sequence;
+		std::memcpy(&sequence, data, 4);
+		uint32_t index = data[4];
+		uint32_t count = data[5];
+		data += 6;
+		size -= 6;
+		if (sequence <= d.recv_sequence) return false; //stale (or repeated)
+		if (count == 0 || index >= count || size > MaxFragmentSize) return false; //malformed
+
+		if (count == 1) {
+			c.recv_buffer.append(data, size);
+			d.recv_sequence = sequence;
+			return true;
+		}
+
+		if (sequence != d.fragment_sequence) {
+			//(any other partly-assembled packet is either stale or never going to finish)
+			d.fragment_sequence = sequence;
+			d.fragments_missing = count;
+			d.fragment_received.assign(count, false);
+			d.fragments.assign(count * MaxFragmentSize, 0);
+		}
+		if (d.fragment_received.size() != count || d.fragment_received[index]) return false;
+		if (index + 1 < count && size != MaxFragmentSize) return false; //(only the last fragment may be short)
+		d.fragment_received[index] = true;
+		d.fragments_missing -= 1;
+		std::memcpy(d.fragments.data() + index * MaxFragmentSize, data, size);
+		if (index + 1 == count) d.fragments.resize((count - 1) * MaxFragmentSize + size);
+		if (d.fragments_missing != 0) return false;
+
+		c.recv_buffer.append(d.fragments.data(), d.fragments.size());
+		d.recv_sequence = sequence;
+		d.fragment_sequence = 0;
+		d.fragments.clear();
+		return true;
+	}
+}
+
+static void send_goodbye(Connection &c) {
+	if (c.datagram->session == 0) return; //(the peer has already gone)
+	send_control_packet("Connection::close", c, Goodbye);
+}
+
+//Polling helper used by both server and client (UDP version):
+// 'peers' is the server's map of peer addresses to connections (nullptr for a client, whose one connection has its own socket).
+static void poll_datagrams(
+	char const *where,
+	Socket socket,
+	std::list< Connection > &connections,
+	std::unordered_map< std::string, Connection * > *peers,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	int wake_fd = -1) {
+	TRACE_ZONE("poll_datagrams");
+
+	//send what was queued since the last poll:
 	for (auto &c : connections) {
-		//don't bother with connections unless they are valid, have something to send, and are marked writable:
-		if (c.socket == InvalidSocket || c.send_buffer.empty() || !FD_ISSET(c.socket, &write_fds)) continue;
-		
-		#ifdef _WIN32
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), int(c.send_buffer.size()), MSG_DONTWAIT);
-		#else
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), c.send_buffer.size(), MSG_DONTWAIT);
-		#endif 
-		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-			//~no problem~, but don't keep trying
-			break;
-		} else if (ret <= 0 || ret > (ssize_t)c.send_buffer.size()) {
+		if (c.socket != InvalidSocket && c.sending()) send_datagrams(where, c, on_event);
+	}
+
+	if (wait_readable(socket, std::max(0.0, timeout), wake_fd)) {
+		std::vector< uint8_t > packet(65536);
+		while (true) {
+			struct sockaddr_storage from;
+			socklen_t from_size = sizeof(from);
+			ssize_t ret = recvfrom(socket, reinterpret_cast< char * >(packet.data()), int(packet.size()), MSG_DONTWAIT,
+				reinterpret_cast< struct sockaddr * >(&from), &from_size);
 			if (ret < 0) {
-				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
-			} else { assert(ret == 0 || ret > (ssize_t)c.send_buffer.size());
-				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << c.send_buffer.size() << "], disconnecting." << std::endl;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) break; //(read everything waiting)
+				if (errno == ECONNREFUSED && !peers) {
+					//(told the server's port is closed; the timeout will close the connection if it stays that way)
+					continue;
+				}
+				std::cerr << "[" << where << "] recvfrom() returned error " << errno << " (" << strerror(errno) << ")." << std::endl;
+				break;
 			}
+			if (size_t(ret) < PacketHeaderSize) continue;
+			uint32_t magic, session;
+			std::memcpy(&magic, packet.data(), 4);
+			PacketKind kind = PacketKind(packet[4]);
+			std::memcpy(&session, packet.data() + 5, 4);
+			if (magic != DatagramMagic) continue;
+
+			//find the connection this packet is for:
+			Connection *c = nullptr;
+			if (peers) {
+				std::string address(reinterpret_cast< char const * >(&from), from_size);
+				auto f = peers->find(address);
+				if (f != peers->end() && f->second->datagram->session != session && kind == Hello) {
+					//peer started over with a new session; drop the old connection (unless it's already closed and just
+					// waiting to be cleaned up, in which case OnClose has been sent):
+					if (f->second->socket != InvalidSocket) {
+						f->second->close();
+						if (on_event) on_event(f->second, Connection::OnClose);
+					}
+					peers->erase(f);
+					f = peers->end();
+				}
+				if (f == peers->end()) {
+					if (kind != Hello) continue;
+					connections.emplace_back();
+					c = &connections.back();
+					c->socket = socket;
+					c->datagram = std::make_unique< Connection::Datagram >();
+					c->datagram->address = address;
+					c->datagram->session = session;
+					c->datagram->last_recv = steady_seconds();
+					peers->emplace(address, c);
+					std::cerr << "[" << where << "] client connected (UDP, session " << session << ")." << std::endl; //INFO
+					if (on_event) on_event(c, Connection::OnOpen);
+					if (c->socket == InvalidSocket) continue; //(turned away by the event handler)
+				} else {
+					c = f->second;
+				}
+			} else {
+				assert(connections.size() == 1);
+				c = &connections.front();
+			}
+			if (c->socket == InvalidSocket || !c->datagram || c->datagram->session != session) continue;
+			c->datagram->last_recv = steady_seconds();
+
+			if (kind == Hello) {
+				if (peers) send_control_packet(where, *c, Welcome); //(again, in case the last Welcome was lost)
+			} else if (kind == Data) {
+				if (recv_data_packet(*c, packet.data() + PacketHeaderSize, size_t(ret) - PacketHeaderSize)) {
+					if (on_event) on_event(c, Connection::OnRecv);
+				}
+			} else if (kind == Goodbye) {
+				std::cerr << "[" << where << "] peer said goodbye, disconnecting." << std::endl;
+				c->datagram->session = 0; //(so close() doesn't say goodbye back)
+				c->close();
+				if (on_event) on_event(c, Connection::OnClose);
+			}
+			//(Welcome and Keepalive just count as hearing from the peer)
+		}
+	}
+
+	//send replies, keep quiet connections alive, and time out silent ones:
+	double now = steady_seconds();
+	for (auto &c : connections) {
+		if (c.socket == InvalidSocket || !c.datagram) continue;
+		if (now - c.datagram->last_recv > DatagramTimeout) {
+			std::cerr << "[" << where << "] heard nothing for " << DatagramTimeout << " seconds, disconnecting." << std::endl;
 			c.close();
 			if (on_event) on_event(&c, Connection::OnClose);
-		} else { //ret seems reasonable
-			c.send_buffer.erase(c.send_buffer.begin(), c.send_buffer.begin() + ret);
+		} else if (c.sending()) {
+			send_datagrams(where, c, on_event);
+		} else if (now - c.datagram->last_send > KeepaliveInterval) {
+			send_control_packet(where, c, Keepalive);
 		}
 	}
+}
 
-		
+//client side of the handshake on a connect()'d UDP socket (returns false if the server didn't answer in time):
+static bool datagram_handshake(Connection &c, double timeout) {
+	double start = steady_seconds();
+	while (steady_seconds() - start < timeout) {
+		send_control_packet("Client::Client", c, Hello);
+		double wait_until = steady_seconds() + HelloInterval;
+		while (true) {
+			double remain = wait_until - steady_seconds();
+			if (remain <= 0.0 || !wait_readable(c.socket, remain)) break;
+			uint8_t packet[MaxPacketSize];
+			ssize_t ret = recv(c.socket, reinterpret_cast< char * >(packet), int(sizeof(packet)), MSG_DONTWAIT);
+			if (ret < 0) {
+				if (errno == ECONNREFUSED) return false; //(nothing listening at this address)
+				continue;
+			}
+			uint32_t magic, session;
+			if (size_t(ret) < PacketHeaderSize) continue;
+			std::memcpy(&magic, packet, 4);
+			std::memcpy(&session, packet + 5, 4);
+			if (magic != DatagramMagic || session != c.datagram->session) continue;
+			if (packet[4] == Welcome) {
+				c.datagram->last_recv = steady_seconds();
+				return true;
+			}
+			if (packet[4] == Goodbye) return false; //(turned away)
+		}
+	}
+	return false;
 }
 
 //---------------------------------
 
 
-Server::Server(std::string const &port) {
+Server::Server(std::string const &port, Transport transport_, IOMode io_mode_) : transport(transport_), io_mode(io_mode_) {
+	#ifndef __linux__
+	io_mode = IOMode::Select;
+	#endif
+	if (transport == Transport::UDP) io_mode = IOMode::Select; //(datagrams have their own loop; see poll_datagrams)
 
 	#ifdef _WIN32
 	{ //init winsock:
@@ -193,13 +1661,23 @@ Server::Server(std::string const &port) {
 			throw std::runtime_error("WSAStartup failed.");
 		}
 	}
+	#else
+	{ //pipe for wake() (non-blocking, so writing never stalls and poll() can read until it's empty):
+		if (pipe(wake_pipe) != 0) {
+			throw std::system_error(errno, std::system_category(), "failed to create wake pipe");
+		}
+		for (int fd : wake_pipe) {
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+	}
 	#endif
 
 	{ //use getaddrinfo to look up how to bind to port:
 		struct addrinfo hints;
 		memset(&hints, 0, sizeof(hints));
 		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_socktype = (transport == Transport::UDP ? SOCK_DGRAM : SOCK_STREAM);
 		hints.ai_flags = AI_PASSIVE;
 
 		struct addrinfo *res = nullptr;
@@ -265,29 +1743,153 @@ Server::Server(std::string const &port) {
 		throw std::runtime_error("Failed to bind to port " + port);
 	}
 
+	if (transport == Transport::UDP) {
+		//no listening or accepting; connections are created as clients say hello (see poll_datagrams):
+		#ifdef _WIN32
+		unsigned long one = 1;
+		if (0 != ioctlsocket(listen_socket, FIONBIO, &one)) {
+			throw std::runtime_error("failed to make socket non-blocking");
+		}
+		#else
+		int flags = fcntl(listen_socket, F_GETFL, 0);
+		if (flags < 0 || fcntl(listen_socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+			throw std::system_error(errno, std::system_category(), "failed to make socket non-blocking");
+		}
+		#endif
+		return;
+	}
+
 	{ //listen on socket
-		int ret = ::listen(listen_socket, 5);
+		//(generous backlog so that a burst of clients connecting at once isn't turned away)
+		int ret = ::listen(listen_socket, SOMAXCONN);
 		if (ret < 0) {
 			closesocket(listen_socket);
 			throw std::system_error(errno, std::system_category(), "failed to listen on socket");
 		}
 	}
+
+	#ifdef __linux__
+	if (io_mode == IOMode::Uring) {
+		#ifdef CONNECTION_HAS_URING
+		uring = create_uring("Server::Server");
+		#else
+		std::cout << "[Server::Server] io_uring support wasn't compiled in; using epoll instead." << std::endl;
+		#endif
+		if (!uring) io_mode = IOMode::Epoll;
+	}
+	if (io_mode == IOMode::Select) return;
+
+	{ //non-blocking, so poll can accept() until there are no more waiting:
+		int flags = fcntl(listen_socket, F_GETFL, 0);
+		if (flags < 0 || fcntl(listen_socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+			throw std::system_error(errno, std::system_category(), "failed to make listen socket non-blocking");
+		}
+	}
+	//(with io_uring, shared-memory clients aren't taken; they connect over TCP instead)
+	if (io_mode == IOMode::Uring) return;
+
+	{ //set up epoll, watching the listen socket for new connections:
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+		}
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.ptr = nullptr; //(nullptr marks the listen socket)
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &event) != 0) {
+			throw std::system_error(errno, std::system_category(), "failed to add listen socket to epoll set");
+		}
+		event.data.ptr = &WakeMarker;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_pipe[0], &event) != 0) {
+			throw std::system_error(errno, std::system_category(), "failed to add wake pipe to epoll set");
+		}
+	}
+
+	{ //also take clients on this machine over shared memory (see Transport::SharedMemory):
+		struct sockaddr_un address;
+		socklen_t address_size = local_address(port, &address);
+		Socket s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (s != InvalidSocket
+		 && bind(s, reinterpret_cast< struct sockaddr const * >(&address), address_size) == 0
+		 && ::listen(s, SOMAXCONN) == 0) {
+			local_socket = s;
+			struct epoll_event event;
+			event.events = EPOLLIN;
+			event.data.ptr = &LocalListenMarker;
+			if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, local_socket, &event) != 0) {
+				throw std::system_error(errno, std::system_category(), "failed to add local socket to epoll set");
+			}
+			std::cout << "[Server::Server] local clients can also connect to " << port << " through shared memory." << std::endl;
+		} else {
+			std::cout << "[note: couldn't listen for local clients: " << strerror(errno) << "]" << std::endl;
+			if (s != InvalidSocket) ::close(s);
+		}
+	}
+	#endif
+}
+
+Server::~Server() {
+	#ifdef __linux__
+	if (local_socket != InvalidSocket) ::close(local_socket);
+	if (epoll_fd >= 0) ::close(epoll_fd);
+	#endif
+	#ifndef _WIN32
+	for (int fd : wake_pipe) {
+		if (fd >= 0) ::close(fd);
+	}
+	#endif
 }
 
 void Server::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
-	poll_connections("Server::poll", connections, on_event, timeout, listen_socket);
+	#ifdef _WIN32
+	int wake_fd = -1;
+	#else
+	int wake_fd = wake_pipe[0];
+	#endif
+	if (transport == Transport::UDP) {
+		poll_datagrams("Server::poll", listen_socket, connections, &datagram_peers, on_event, timeout, wake_fd);
+	#ifdef CONNECTION_HAS_URING
+	} else if (io_mode == IOMode::Uring) {
+		poll_connections_uring("Server::poll", *uring, connections, on_event, timeout, listen_socket, wake_fd);
+	#endif
+	#ifdef __linux__
+	} else if (io_mode == IOMode::Epoll) {
+		poll_connections_epoll("Server::poll", epoll_fd, connections, send_list, on_event, timeout, listen_socket, local_socket);
+	#endif
+	} else {
+		poll_connections("Server::poll", connections, on_event, timeout, listen_socket, wake_fd);
+	}
+
+	#ifndef _WIN32
+	{ //empty the wake pipe (anything written after this wakes the next poll):
+		char bytes[64];
+		while (read(wake_fd, bytes, sizeof(bytes)) > 0) { }
+	}
+	#endif
 
 	//reap closed clients:
 	for (auto connection = connections.begin(); connection != connections.end(); /*later*/) {
 		auto old = connection;
 		++connection;
 		if (old->socket == InvalidSocket) {
+			if (old->datagram) {
+				auto f = datagram_peers.find(old->datagram->address);
+				if (f != datagram_peers.end() && f->second == &*old) datagram_peers.erase(f);
+			}
 			connections.erase(old);
 		}
 	}
 }
 
-Client::Client(std::string const &host, std::string const &port) : connections(1), connection(connections.front()) {
+void Server::wake() {
+	#ifndef _WIN32
+	char byte = 0;
+	ssize_t ret = write(wake_pipe[1], &byte, 1);
+	(void)ret; //(EAGAIN: the pipe is full of wakeups already)
+	#endif
+}
+
+Client::Client(std::string const &host, std::string const &port, Transport transport, IOMode io_mode_) : connections(1), connection(connections.front()), io_mode(io_mode_) {
 	#ifdef _WIN32
 	{ //init winsock:
 		WSADATA info;
@@ -297,12 +1899,20 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 	}
 	#endif
 
-	{ //use getaddrinfo to look up how to bind to host/port:
+	if (transport == Transport::SharedMemory) {
+		#ifdef __linux__
+		std::cout << "[Client::Client] connecting to local port " << port << " through shared memory... "; std::cout.flush();
+		connect_local(connection, port);
+		std::cout << "success!" << std::endl;
+		#else
+		throw std::runtime_error("The shared-memory transport is only available on linux.");
+		#endif
+	} else { //use getaddrinfo to look up how to bind to host/port:
 		struct addrinfo hints;
 		memset(&hints, 0, sizeof(hints));
 		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_protocol = IPPROTO_TCP;
+		hints.ai_socktype = (transport == Transport::UDP ? SOCK_DGRAM : SOCK_STREAM);
+		hints.ai_protocol = (transport == Transport::UDP ? IPPROTO_UDP : IPPROTO_TCP);
 
 		struct addrinfo *res = nullptr;
 		int addrinfo_ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
@@ -338,8 +1948,30 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 			int ret = connect(s, info->ai_addr, int(info->ai_addrlen));
 			if (ret < 0) {
 				std::cout << "(failed to connect: " << strerror(errno) << ")" << std::endl;
+				closesocket(s);
 				continue;
 			}
+
+			if (transport == Transport::UDP) {
+				//(connect() on a UDP socket only picks the peer, so say hello to find out if anyone is there)
+				#ifdef _WIN32
+				unsigned long one = 1;
+				ioctlsocket(s, FIONBIO, &one);
+				#else
+				fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+				#endif
+				connection.socket = s;
+				connection.datagram = std::make_unique< Connection::Datagram >();
+				do {
+					connection.datagram->session = std::random_device()();
+				} while (connection.datagram->session == 0);
+				if (!datagram_handshake(connection, 5.0)) {
+					std::cout << "(no answer to handshake)" << std::endl;
+					connection.datagram.reset();
+					connection.close();
+					continue;
+				}
+			}
 			std::cout << "success!" << std::endl;
 
 			connection.socket = s;
@@ -352,10 +1984,66 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 			throw std::runtime_error("Failed to connect to any of the addresses tried for server.");
 		}
 	}
+
+	#ifndef __linux__
+	io_mode = IOMode::Select;
+	#endif
+	if (transport == Transport::UDP) io_mode = IOMode::Select; //(see poll_datagrams)
+	if (transport == Transport::SharedMemory) io_mode = IOMode::Epoll; //(waits on the ring's eventfd)
+	if (io_mode == IOMode::Select) return;
+
+	#ifdef __linux__
+	if (io_mode == IOMode::Uring) {
+		#ifdef CONNECTION_HAS_URING
+		uring = create_uring("Client::Client");
+		#else
+		std::cout << "[Client::Client] io_uring support wasn't compiled in; using epoll instead." << std::endl;
+		#endif
+		if (uring) return;
+		io_mode = IOMode::Epoll;
+	}
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+	}
+	register_connection("Client::Client", epoll_fd, send_list, connection);
+	if (connection.shared_memory) {
+		struct epoll_event event;
+		event.events = EPOLLIN | EPOLLET;
+		event.data.ptr = &connection;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection.shared_memory->wake_in, &event) != 0) {
+			throw std::system_error(errno, std::system_category(), "failed to add eventfd to epoll set");
+		}
+	}
+	#endif
+}
+
+Client::~Client() {
+	#ifdef __linux__
+	if (epoll_fd >= 0) ::close(epoll_fd);
+	#endif
 }
 
 
 void Client::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	if (connection.datagram) {
+		if (connection.socket == InvalidSocket) return; //(closed)
+		poll_datagrams("Client::poll", connection.socket, connections, nullptr, on_event, timeout);
+		return;
+	}
+	#ifdef CONNECTION_HAS_URING
+	if (io_mode == IOMode::Uring) {
+		poll_connections_uring("Client::poll", *uring, connections, on_event, timeout);
+		return;
+	}
+	#endif
+	#ifdef __linux__
+	if (io_mode == IOMode::Epoll) {
+		poll_connections_epoll("Client::poll", epoll_fd, connections, send_list, on_event, timeout, InvalidSocket);
+		return;
+	}
+	#endif
 	poll_connections("Client::poll", connections, on_event, timeout, InvalidSocket);
 }
 
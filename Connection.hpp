@@ -14,7 +14,7 @@ int main(int argc, char **argv) {
 		server.poll([](Connection *connection, Connection::Event evt){
 			if (evt == Connection::OnRecv) {
 				//extract and erase data from the connection's recv_buffer:
-				std::vector< uint8_t > data = connection->recv_buffer;
+				std::vector< uint8_t > data(connection->recv_buffer.data(), connection->recv_buffer.data() + connection->recv_buffer.size());
 				connection->recv_buffer.clear();
 				//send to other connections:
 
@@ -62,10 +62,94 @@ int main(int argc, char **argv) {
 
 #include <vector>
 #include <list>
+#include <deque>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <functional>
+#include <cassert>
+#include <cstdint>
 
-//Thin wrapper around a (polling-based) TCP socket connection:
+//Queue of bytes, used for Connection's send and receive buffers:
+// - queued bytes are always contiguous (so messages can be parsed and sent in place),
+// - consume() removes bytes from the front in O(1) by advancing 'head',
+// - space at the end is made by sliding the queued bytes back to the start of storage, but only
+//   once at least as many bytes have been consumed as are still queued (otherwise storage grows),
+//   so every byte is moved at most a constant number of times on average.
+struct ByteQueue {
+	size_t size() const { return tail - head; }
+	bool empty() const { return tail == head; }
+
+	uint8_t *data() { return storage.data() + head; }
+	uint8_t const *data() const { return storage.data() + head; }
+	uint8_t &operator[](size_t i) { assert(i < size()); return storage[head + i]; }
+	uint8_t const &operator[](size_t i) const { assert(i < size()); return storage[head + i]; }
+
+	//add bytes at the end:
+	void append(void const *bytes, size_t count);
+	//remove 'count' bytes from the front:
+	void consume(size_t count) {
+		assert(count <= size());
+		head += count;
+		if (head == tail) head = tail = 0; //(empty: next append starts at the front again)
+	}
+	void clear() { head = tail = 0; }
+
+	//writing in place (e.g., recv() straight into the queue):
+	//prepare() returns space for at least 'count' bytes at the end; write into it, then commit() the bytes actually written:
+	uint8_t *prepare(size_t count);
+	void commit(size_t count) {
+		assert(tail + count <= storage.size());
+		tail += count;
+	}
+
+	//internals:
+	std::vector< uint8_t > storage; //bytes [head, tail) are queued; storage.size() is the capacity
+	size_t head = 0;
+	size_t tail = 0;
+};
+
+//Immutable bytes that can be queued on many connections at once (see Connection::send_shared):
+typedef std::shared_ptr< std::vector< uint8_t > const > SharedBytes;
+
+//How a Server and its Clients talk (both ends must use the same one, except that a TCP server also takes SharedMemory clients):
+// - TCP: messages arrive reliably and in order.
+// - UDP: messages queued between polls are packed into datagrams (a message is never split between two datagrams,
+//   but one too big for a datagram is sent in fragments; sending one over ~300k closes the connection). Datagrams may be lost, and any that arrive after a newer one
+//   are dropped as stale, so messages arrive in order but not all of them do. A small handshake opens the connection,
+//   keepalives are sent when there is nothing else to send, and a connection that hears nothing for a while closes.
+//   Message code can check Connection::unreliable() to compensate (e.g., by resending what matters).
+// - SharedMemory (linux only, for clients on the same machine as the server): messages arrive reliably and in order, like TCP,
+//   but through a pair of ring buffers in memory shared with the server, so sending and receiving are just copies (with a
+//   system call only to wake a peer that has run out of data). The client names the server's port; the host is ignored.
+enum class Transport : uint8_t {
+	TCP,
+	UDP,
+	SharedMemory
+};
+
+//How a Server or Client waits for and does its (TCP) socket I/O:
+// - Select: select() on every socket, every poll (works everywhere, but only for up to FD_SETSIZE sockets);
+// - Epoll (linux): sockets stay registered with the kernel, which reports just the ones that have something to do;
+// - Uring (linux 6.0+): io_uring. Accepts and receives are set up once and keep completing (receives land in buffers
+//   handed to the kernel ahead of time), and each poll's sends go in together with its wait, so a broadcast to every
+//   connection takes one system call rather than one per connection. Falls back to Epoll where io_uring isn't available.
+// (UDP always waits with select(); shared-memory clients are only taken in Epoll mode)
+enum class IOMode : uint8_t {
+	Select,
+	Epoll,
+	Uring
+};
+#ifdef __linux__
+constexpr IOMode DefaultIOMode = IOMode::Epoll;
+#else
+constexpr IOMode DefaultIOMode = IOMode::Select;
+#endif
+
+struct IoUring; //(io_uring back-end state; see Connection.cpp)
+
+//Thin wrapper around a (polling-based) TCP socket connection, a UDP "connection" with one peer, or a shared-memory link to a local peer:
+// (TCP waits in the way IOMode picks: with epoll or io_uring on linux, many thousands of connections are fine)
 struct Connection {
 	//Helper that will append any type to the send buffer:
 	template< typename T >
@@ -74,22 +158,104 @@ struct Connection {
 	}
 	//Helper that will append raw bytes to the send buffer:
 	void send_raw(void const *data, size_t size) {
-		send_buffer.insert(send_buffer.end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+		send_buffer.append(data, size);
+		if (send_list && !on_send_list) join_send_list();
 	}
+	//Queue bytes shared with other connections; they go out after everything queued so far, without being copied:
+	void send_shared(SharedBytes const &bytes);
+	//Queue a message of a short per-connection 'head' (up to SharedSend::MaxHead bytes) followed by shared 'body'
+	// that is only worth sending until a newer one replaces it (e.g., a whole game state):
+	// any earlier such message that hasn't started going out yet is dropped (and counted in 'superseded').
+	// (TCP on windows and UDP queue everything by copying, so nothing is replaced there)
+	void send_latest(void const *head, size_t head_size, SharedBytes const &body);
+
+	//is anything (in send_buffer or shared) waiting to be sent?
+	bool sending() const { return !send_buffer.empty() || !shared_sends.empty(); }
+	//bytes waiting to be sent:
+	size_t queued_bytes() const { return send_buffer.size() + shared_queued; }
+
+	//A reader that can't keep up only costs its own queue -- every poll sends what each socket will take, and moves on --
+	// and that queue stays short as long as most of what is sent goes through send_latest(). Past 'send_limit' bytes, the connection is closed.
+	size_t send_limit = size_t(1) << 20;
+	//send queue metrics (reset by whoever reports them):
+	size_t peak_backlog = 0; //most bytes left waiting after a poll's sends
+	uint64_t superseded = 0; //send_latest() messages dropped unsent
+
+	//might messages sent over this connection be lost? (see Transport::UDP)
+	bool unreliable() const { return datagram != nullptr; }
 
 	//Call 'close' to mark a connection for discard:
 	void close();
 
+	~Connection(); //(leaves send_list)
+
 	//so you can if(connection) ... to check for validity:
 	explicit operator bool() { return socket != InvalidSocket; }
 
 	//To send data over a connection, append it to send_buffer:
-	std::vector< uint8_t > send_buffer;
+	ByteQueue send_buffer;
 	//When the connection receives data, it is appended to recv_buffer:
-	std::vector< uint8_t > recv_buffer;
+	// (consume() each message once it has been handled)
+	ByteQueue recv_buffer;
 
 	//internals:
 	Socket socket = InvalidSocket;
+	bool watching_writes = false; //(epoll back-end) waiting for the socket to take more queued data?
+	//(epoll back-end) connections that have queued something since their sends were last tried are linked into a list,
+	// so that a poll only has to look at those, however many connections are idle:
+	struct SendList {
+		Connection *first = nullptr;
+	};
+	SendList *send_list = nullptr; //list to join when something is queued (nullptr: not tracked)
+	bool on_send_list = false;
+	Connection *send_list_prev = nullptr;
+	Connection *send_list_next = nullptr;
+	void join_send_list();
+	void leave_send_list();
+	uint64_t uring_id = 0; //(io_uring back-end) names this connection's operations in flight (0: none yet)
+
+	//shared byte ranges waiting to be sent, in order; each goes out once the send_buffer bytes queued before it have:
+	struct SharedSend {
+		uint64_t at; //position in the send_buffer byte stream (see send_buffer_sent) this follows
+		inline static constexpr size_t MaxHead = 32;
+		uint8_t head[MaxHead]; //per-connection bytes sent just before 'bytes'
+		uint8_t head_size = 0;
+		bool latest = false; //queued by send_latest() (so may be replaced)
+		SharedBytes bytes;
+		size_t offset = 0; //bytes (of head, then bytes) already sent
+		size_t size() const { return head_size + bytes->size(); }
+	};
+	std::deque< SharedSend > shared_sends;
+	size_t shared_queued = 0; //bytes of shared_sends not yet sent
+	uint64_t send_buffer_sent = 0; //total bytes sent from send_buffer so far
+
+	//UDP transport state (see Connection.cpp for the packet format):
+	struct Datagram {
+		std::string address; //peer's socket address (server side, where every connection shares one socket; empty on the client's own, connect()'d, socket)
+		uint32_t session = 0; //picked by the client for its handshake; packets from the peer with any other session are ignored
+		uint32_t send_sequence = 0; //sequence number of the last packet sent
+		uint32_t recv_sequence = 0; //sequence number of the newest packet delivered (anything older is stale)
+		double last_send = 0.0; //(steady clock seconds) for keepalives
+		double last_recv = 0.0; //(steady clock seconds) for timeouts
+		//packet being put back together from fragments:
+		uint32_t fragment_sequence = 0;
+		uint32_t fragments_missing = 0;
+		std::vector< bool > fragment_received;
+		std::vector< uint8_t > fragments;
+	};
+	std::unique_ptr< Datagram > datagram; //(nullptr for TCP connections)
+
+	//shared-memory transport state (see Connection.cpp for the segment layout):
+	// ('socket' is then a unix socket that carries nothing after the handshake, but tells each side when the other goes away)
+	struct SharedMemory {
+		~SharedMemory(); //(unmaps the segment and closes the eventfds)
+		void *segment = nullptr; //mapped segment (nullptr until the server has received it from the client)
+		size_t in = 0; //offset of the ring messages arrive on
+		size_t out = 0; //offset of the ring messages are sent on
+		int wake_in = -1; //eventfd the peer signals after writing to 'in'
+		int wake_out = -1; //eventfd to signal after writing to 'out'
+	};
+	std::unique_ptr< SharedMemory > shared_memory; //(nullptr unless Transport::SharedMemory)
 
 	enum Event {
 		OnOpen,
@@ -99,7 +265,11 @@ struct Connection {
 };
 
 struct Server {
-	Server(std::string const &port); //pass the port number to listen on, as a string (servname, really)
+	Server(std::string const &port, Transport transport = Transport::TCP, IOMode io_mode = DefaultIOMode); //pass the port number to listen on, as a string (servname, really)
+	~Server();
+
+	//(epoll back-end) connections with sends to try -- declared before 'connections', which leave it as they are destroyed:
+	Connection::SendList send_list;
 
 	//poll() updates the list of active connections and sends/receives data if possible:
 	// (will wait up to 'timeout' for first event)
@@ -108,13 +278,32 @@ struct Server {
 		double timeout = 0.0 //timeout (seconds)
 	);
 
+	//make a poll() that is waiting (or the next one) return right away -- the one call that is safe from another thread:
+	// (on windows this does nothing, so poll() waits out its timeout)
+	void wake();
+
 	std::list< Connection > connections;
-	Socket listen_socket = InvalidSocket;
+	Socket listen_socket = InvalidSocket; //(with Transport::UDP, the one socket all connections share)
+	Socket local_socket = InvalidSocket; //(linux, Transport::TCP) unix socket that SharedMemory clients connect to
+	Transport transport;
+	IOMode io_mode; //(what is actually in use, after any fallback)
+	std::unordered_map< std::string, Connection * > datagram_peers; //(UDP) connection for each peer address
+	#ifdef __linux__
+	int epoll_fd = -1; //listen socket and connections stay registered here between polls
+	#endif
+	std::unique_ptr< IoUring > uring; //(IOMode::Uring)
+	#ifndef _WIN32
+	int wake_pipe[2] = {-1, -1}; //wake() writes to [1]; poll() also waits on (and empties) [0]
+	#endif
 };
 
 
 struct Client {
-	Client(std::string const &host, std::string const &port);
+	Client(std::string const &host, std::string const &port, Transport transport = Transport::TCP, IOMode io_mode = DefaultIOMode); //(throws if the server can't be reached)
+	~Client();
+
+	//(epoll back-end) the connection, when it has sends to try -- declared before 'connections', as in Server:
+	Connection::SendList send_list;
 
 	//poll() checks the status of the active connection and sends/receives data if possible:
 	// (will wait up to 'timeout' for first event)
@@ -125,4 +314,9 @@ struct Client {
 
 	std::list< Connection > connections; //will only ever contain exactly one connection
 	Connection &connection; //reference to the only connection in the connections list
+	IOMode io_mode; //(what is actually in use, after any fallback)
+	#ifdef __linux__
+	int epoll_fd = -1;
+	#endif
+	std::unique_ptr< IoUring > uring; //(IOMode::Uring)
 };
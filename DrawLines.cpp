@@ -3,6 +3,7 @@
 #include "ColorProgram.hpp"
 
 #include "gl_errors.hpp"
+#include "Trace.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -134,6 +135,7 @@ void DrawLines::draw_text(std::string const &text, glm::vec3 const &anchor_in, g
 
 DrawLines::~DrawLines() {
 	if (attribs.empty()) return;
+	TRACE_ZONE("DrawLines::~DrawLines");
 
 	//based on DrawSprites.cpp :
 
@@ -1,43 +1,80 @@
 #include "Game.hpp"
 
 #include "Connection.hpp"
+#include "Collision.hpp"
+#include "WorkerPool.hpp"
+#include "Trace.hpp"
 
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
-#include <stdlib.h>     /* srand, rand */
-#include <time.h>       /* time */
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <type_traits>
 
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/string_cast.hpp>
 
-void Player::Controls::send_controls_message(Connection *connection_) const {
+//controls message: [u8 count] then, newest first, count x [u32 step][6 bytes of buttons (bit 7: pressed, bits 0-6: downs)]
+
+static uint8_t encode_button(Button const &b) {
+	if (b.downs & 0x80) {
+		std::cerr << "Wow, you are really good at pressing buttons!" << std::endl;
+	}
+	return uint8_t( (b.pressed ? 0x80 : 0x00) | (b.downs & 0x7f) );
+}
+
+bool Player::Controls::should_send() const {
+	if (sent[0].sequence == 0 || sequence - sent[0].sequence >= KeepaliveSteps) return true;
+	Button const *buttons[6] = {&left, &right, &up, &down, &jump, &shoot};
+	for (uint32_t i = 0; i < 6; ++i) {
+		if (buttons[i]->downs != 0 || buttons[i]->pressed != bool(sent[0].buttons[i] & 0x80)) return true;
+	}
+	return false;
+}
+
+void Player::Controls::send_controls_message(Connection *connection_) {
 	assert(connection_);
 	auto &connection = *connection_;
 
-	uint32_t size = 6;
+	//remember this message's buttons (dropping the oldest):
+	std::move_backward(sent, sent + Redundancy - 1, sent + Redundancy);
+	sent[0].sequence = sequence;
+	uint8_t *buttons = sent[0].buttons;
+	buttons[0] = encode_button(left);
+	buttons[1] = encode_button(right);
+	buttons[2] = encode_button(up);
+	buttons[3] = encode_button(down);
+	buttons[4] = encode_button(jump);
+	buttons[5] = encode_button(shoot);
+
+	uint8_t count = 1;
+	if (connection.unreliable()) {
+		while (count < Redundancy && sent[count].sequence != 0) ++count;
+	}
+	uint32_t size = 1 + (4 + 6) * count;
 	connection.send(Message::C2S_Controls);
 	connection.send(uint8_t(size));
 	connection.send(uint8_t(size >> 8));
 	connection.send(uint8_t(size >> 16));
+	connection.send(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		connection.send(sent[i].sequence);
+		connection.send_raw(sent[i].buttons, 6);
+	}
+}
 
-	auto send_button = [&](Button const &b) {
-		if (b.downs & 0x80) {
-			std::cerr << "Wow, you are really good at pressing buttons!" << std::endl;
-		}
-		connection.send(uint8_t( (b.pressed ? 0x80 : 0x00) | (b.downs & 0x7f) ) );
-	};
-
-	send_button(left);
-	send_button(right);
-	send_button(up);
-	send_button(down);
-	send_button(jump);
-	send_button(shoot);
+bool Player::Controls::recv_controls_message(Connection *connection) {
+	Received received;
+	if (!recv_controls_message(connection, &received)) return false;
+	apply(received);
+	return true;
 }
 
-bool Player::Controls::recv_controls_message(Connection *connection_) {
+bool Player::Controls::recv_controls_message(Connection *connection_, Received *received) {
 	assert(connection_);
+	assert(received);
 	auto &connection = *connection_;
 
 	auto &recv_buffer = connection.recv_buffer;
@@ -48,11 +85,28 @@ bool Player::Controls::recv_controls_message(Connection *connection_) {
 	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
 	              | (uint32_t(recv_buffer[2]) << 8)
 	              |  uint32_t(recv_buffer[1]);
-	if (size != 6) throw std::runtime_error("Controls message with size " + std::to_string(size) + " != 6!");
-	
+	if (size < 1 + 10 || size > 1 + 10 * Redundancy || (size - 1) % 10 != 0) throw std::runtime_error("Controls message with size " + std::to_string(size) + " isn't 1 + 10 * [1," + std::to_string(Redundancy) + "]!");
+
 	//expecting complete message:
 	if (recv_buffer.size() < 4 + size) return false;
 
+	uint32_t count = recv_buffer[4];
+	if (size != 1 + 10 * count) throw std::runtime_error("Controls message with size " + std::to_string(size) + " doesn't match its count (" + std::to_string(count) + ")!");
+
+	received->count = count;
+	for (uint32_t i = 0; i < count; ++i) {
+		uint8_t const *entry = &recv_buffer[4+1 + 10 * i];
+		std::memcpy(&received->steps[i].sequence, entry, 4);
+		std::memcpy(received->steps[i].buttons, entry + 4, 6);
+	}
+
+	//delete message from buffer:
+	recv_buffer.consume(4 + size);
+
+	return true;
+}
+
+void Player::Controls::apply(Received const &received) {
 	auto recv_button = [](uint8_t byte, Button *button) {
 		button->pressed = (byte & 0x80);
 		uint32_t d = uint32_t(button->downs) + uint32_t(byte & 0x7f);
@@ -63,23 +117,126 @@ bool Player::Controls::recv_controls_message(Connection *connection_) {
 		button->downs = uint8_t(d);
 	};
 
-	recv_button(recv_buffer[4+0], &left);
-	recv_button(recv_buffer[4+1], &right);
-	recv_button(recv_buffer[4+2], &up);
-	recv_button(recv_buffer[4+3], &down);
-	recv_button(recv_buffer[4+4], &jump);
-	recv_button(recv_buffer[4+5], &shoot);
+	//apply any of the included steps that weren't seen yet, oldest first:
+	// (presses add up in 'downs', so a press and release that both arrive between ticks still count)
+	for (uint32_t i = received.count; i > 0; --i) {
+		Sent const &step = received.steps[i - 1];
+		if (step.sequence <= sequence) continue; //(already applied)
+		recv_button(step.buttons[0], &left);
+		recv_button(step.buttons[1], &right);
+		recv_button(step.buttons[2], &up);
+		recv_button(step.buttons[3], &down);
+		recv_button(step.buttons[4], &jump);
+		recv_button(step.buttons[5], &shoot);
+		sequence = step.sequence;
+		held_ticks = 0;
+	}
+}
+
+//messages that are just 'count' u32s:
+static void send_u32_message(Connection *connection_, Message type, uint32_t const *values, uint32_t count) {
+	assert(connection_);
+	auto &connection = *connection_;
+
+	uint32_t size = 4 * count;
+	connection.send(type);
+	connection.send(uint8_t(size));
+	connection.send(uint8_t(size >> 8));
+	connection.send(uint8_t(size >> 16));
+	connection.send_raw(values, size);
+}
+
+static bool recv_u32_message(Connection *connection_, Message type, uint32_t *values, uint32_t count) {
+	assert(connection_);
+	assert(values);
+	auto &connection = *connection_;
+
+	auto &recv_buffer = connection.recv_buffer;
+
+	//expecting [type, size_low0, size_mid8, size_high8]:
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(type)) return false;
+	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+	              | (uint32_t(recv_buffer[2]) << 8)
+	              |  uint32_t(recv_buffer[1]);
+	if (size != 4 * count) throw std::runtime_error("Message of type " + std::to_string(int(type)) + " with size " + std::to_string(size) + " != " + std::to_string(4 * count) + "!");
+
+	//expecting complete message:
+	if (recv_buffer.size() < 4 + size) return false;
+
+	std::memcpy(values, &recv_buffer[4], size);
 
 	//delete message from buffer:
-	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	recv_buffer.consume(4 + size);
 
 	return true;
 }
 
+void send_ping_message(Connection *connection, Message type, uint32_t token) {
+	assert(type == Message::C2S_Ping || type == Message::S2C_Pong);
+	send_u32_message(connection, type, &token, 1);
+}
+
+bool recv_ping_message(Connection *connection, Message type, uint32_t *token) {
+	assert(type == Message::C2S_Ping || type == Message::S2C_Pong);
+	return recv_u32_message(connection, type, token, 1);
+}
+
+void send_ack_message(Connection *connection, uint32_t tick, uint32_t roster_version) {
+	uint32_t values[2] = {tick, roster_version};
+	send_u32_message(connection, Message::C2S_Ack, values, 2);
+}
+
+bool recv_ack_message(Connection *connection, uint32_t *tick, uint32_t *roster_version) {
+	assert(tick && roster_version);
+	uint32_t values[2];
+	if (!recv_u32_message(connection, Message::C2S_Ack, values, 2)) return false;
+	*tick = values[0];
+	*roster_version = values[1];
+	return true;
+}
 
 //-----------------------------------------
 
-Game::Game() : mt(0x15466666) {
+UniformGrid::UniformGrid(glm::vec2 const &min, glm::vec2 const &max, float cell_size_) : cell_size(cell_size_), origin(min) {
+	size.x = std::max(1, int(std::ceil((max.x - min.x) / cell_size)));
+	size.y = std::max(1, int(std::ceil((max.y - min.y) / cell_size)));
+	cell_start.assign(size.x * size.y + 1, 0);
+}
+
+glm::ivec2 UniformGrid::cell(glm::vec2 const &at) const {
+	int x = int(std::floor((at.x - origin.x) / cell_size));
+	int y = int(std::floor((at.y - origin.y) / cell_size));
+	return glm::ivec2(std::clamp(x, 0, size.x - 1), std::clamp(y, 0, size.y - 1));
+}
+
+//is a bullet at offset (dx, dy) from a player's center touching the player?
+// Gives exactly the same answer as the original
+//   float(std::sqrt(std::pow(dx, 2) + std::pow(dy, 2))) < PlayerRadius + BulletRadius
+// test, but only takes the square root when the squared distance is within a hair of the boundary.
+static bool bullet_touches_player(float dx, float dy) {
+	constexpr double R = double(Game::PlayerRadius + Game::BulletRadius);
+	constexpr double Inside = (R * (1.0 - 1e-6)) * (R * (1.0 - 1e-6));
+	constexpr double Outside = (R * (1.0 + 1e-6)) * (R * (1.0 + 1e-6));
+	double d2 = double(dx) * double(dx) + double(dy) * double(dy);
+	if (d2 < Inside) return true;
+	if (d2 > Outside) return false;
+	return float(std::sqrt(d2)) < Game::PlayerRadius + Game::BulletRadius;
+}
+
+//-----------------------------------------
+
+Random::Random(uint64_t seed, uint64_t stream) {
+	//seeding procedure from the PCG reference implementation:
+	increment = (stream << 1u) | 1u;
+	(*this)();
+	state += seed;
+	(*this)();
+}
+
+//-----------------------------------------
+
+Game::Game(uint64_t seed) : rng(seed), platform_grid(ArenaMin, ArenaMax, 0.125f), player_grid(ArenaMin, ArenaMax, 0.125f) {
 	// horizontal
 	{
 		platforms.emplace_back();
@@ -118,26 +275,33 @@ Game::Game() : mt(0x15466666) {
 		platforms.back().positionMax = glm::vec2(-0.4f, -0.2f);
 	}
 
-	srand((unsigned int)time(NULL)); // https://cplusplus.com/reference/cstdlib/rand/
+	index_platforms();
 }
 
 Player *Game::spawn_player() {
+	//(players tell their bullets apart by color, so there can't be more of them than colors)
+	if (players.size() >= MaxPlayers) throw std::runtime_error("Can't have more than " + std::to_string(MaxPlayers) + " players in a game.");
 	players.emplace_back();
 	Player &player = players.back();
 
 	//random point in the middle area of the arena:
-	player.position.x = glm::mix(ArenaMin.x + 2.0f * PlayerRadius, ArenaMax.x - 2.0f * PlayerRadius, 0.4f + 0.2f * mt() / float(mt.max()));
-	player.position.y = glm::mix(ArenaMin.y + 2.0f * PlayerRadius, ArenaMax.y - 2.0f * PlayerRadius, 0.4f + 0.2f * mt() / float(mt.max()));
+	player.position.x = glm::mix(ArenaMin.x + 2.0f * PlayerRadius, ArenaMax.x - 2.0f * PlayerRadius, 0.4f + 0.2f * rng() / float(rng.max()));
+	player.position.y = glm::mix(ArenaMin.y + 2.0f * PlayerRadius, ArenaMax.y - 2.0f * PlayerRadius, 0.4f + 0.2f * rng() / float(rng.max()));
 	player.position.y = ArenaMin.y + 2.0f * PlayerRadius;
 
-	do {
-		player.color.r = mt() / float(mt.max());
-		player.color.g = mt() / float(mt.max());
-		player.color.b = mt() / float(mt.max());
-	} while (player.color == glm::vec3(0.0f));
-	player.color = glm::normalize(player.color);
+	//first palette color no one else is using (there always is one, given the check above):
+	std::array< bool, PaletteSize > used{};
+	used[UnownedColor] = true;
+	for (auto const &other : players) {
+		if (&other != &player) used[other.color] = true;
+	}
+	uint32_t color = 0;
+	while (used[color]) ++color;
+	player.color = uint8_t(color);
 
+	player.id = next_player_number;
 	player.name = "Player " + std::to_string(next_player_number++);
+	roster_version += 1;
 
 	return &player;
 }
@@ -147,6 +311,7 @@ void Game::remove_player(Player *player) {
 	for (auto pi = players.begin(); pi != players.end(); ++pi) {
 		if (&*pi == player) {
 			players.erase(pi);
+			roster_version += 1;
 			found = true;
 			break;
 		}
@@ -154,6 +319,80 @@ void Game::remove_player(Player *player) {
 	assert(found);
 }
 
+glm::vec3 const &Game::palette(uint8_t color) {
+	static std::array< glm::vec3, PaletteSize > const colors = [](){
+		std::array< glm::vec3, PaletteSize > ret;
+		for (uint32_t i = 0; i < PaletteSize; ++i) {
+			//hues spaced by the golden angle (so colors handed out in order are far apart), runs of 16 cycling through three levels of paleness:
+			float hue = std::fmod(float(i) * 0.381966f, 1.0f) * 6.0f;
+			glm::vec3 rgb(
+				std::clamp(std::abs(hue - 3.0f) - 1.0f, 0.0f, 1.0f),
+				std::clamp(2.0f - std::abs(hue - 2.0f), 0.0f, 1.0f),
+				std::clamp(2.0f - std::abs(hue - 4.0f), 0.0f, 1.0f)
+			);
+			rgb = glm::mix(rgb, glm::vec3(1.0f), 0.25f * float((i / 16) % 3));
+			ret[i] = glm::normalize(rgb);
+		}
+		return ret;
+	}();
+	return colors[color];
+}
+
+void Game::index_platforms() {
+	//bucket platforms by the cells they overlap:
+	// (padded slightly so that rounding in cell() can't miss a touching box)
+	platform_grid.build(uint32_t(platforms.size()), [this](uint32_t i, glm::ivec2 *lo, glm::ivec2 *hi){
+		*lo = platform_grid.cell(platforms[i].positionMin - glm::vec2(1e-4f));
+		*hi = platform_grid.cell(platforms[i].positionMax + glm::vec2(1e-4f));
+	});
+
+	//copy each cell's platform bounds into a BoxBatch-aligned run for overlap_mask():
+	platform_boxes.clear();
+	platform_box_ids.clear();
+	platform_box_start.assign(platform_grid.cell_start.size(), 0);
+	for (size_t c = 0; c + 1 < platform_grid.cell_start.size(); ++c) {
+		platform_box_start[c] = uint32_t(platform_boxes.size());
+		for (uint32_t e = platform_grid.cell_start[c]; e < platform_grid.cell_start[c+1]; ++e) {
+			uint32_t i = platform_grid.entries[e];
+			platform_boxes.push(platforms[i].positionMin, platforms[i].positionMax);
+			platform_box_ids.emplace_back(i);
+		}
+		while (platform_box_ids.size() % BoxBatch != 0) {
+			platform_boxes.push_empty();
+			platform_box_ids.emplace_back(uint32_t(-1));
+		}
+	}
+	platform_box_start.back() = uint32_t(platform_boxes.size());
+}
+
+void Game::find_overlapping_platforms(QueryBox const &box, std::vector< uint32_t > *out_) const {
+	assert(out_);
+	auto &out = *out_;
+	out.clear();
+
+	glm::ivec2 lo = platform_grid.cell(glm::vec2(box.left, box.bottom));
+	glm::ivec2 hi = platform_grid.cell(glm::vec2(box.right, box.top));
+	for (int y = lo.y; y <= hi.y; ++y) {
+		for (int x = lo.x; x <= hi.x; ++x) {
+			uint32_t c = platform_grid.cell_index(glm::ivec2(x, y));
+			for (uint32_t first = platform_box_start[c]; first < platform_box_start[c+1]; first += BoxBatch) {
+				uint32_t mask = overlap_mask(box, platform_boxes, first);
+				for (uint32_t bit = 0; mask; ++bit, mask >>= 1) {
+					if (!(mask & 1u)) continue;
+					uint32_t id = platform_box_ids[first + bit];
+					if (id != uint32_t(-1)) out.emplace_back(id); //(padding only "overlaps" NaN boxes)
+				}
+			}
+		}
+	}
+
+	//platforms spanning several cells show up more than once; callers expect level order:
+	if (lo != hi) {
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	}
+}
+
 // https://lazyfoo.net/tutorials/SDL/27_collision_detection/index.php
 bool Game::check_collision(float leftA, float leftB, float rightA, float rightB, float topA, float topB, float bottomA, float bottomB) {
 	//If any of the sides from A are outside of B
@@ -177,14 +416,28 @@ bool Game::check_collision(float leftA, float leftB, float rightA, float rightB,
     return true;
 }
 
+void Game::for_each_chunk(uint32_t count, std::function< void(uint32_t, uint32_t, uint32_t) > const &fn) {
+	uint32_t chunks = (workers ? workers->size() : 1);
+	if (chunk_scratch.size() < chunks) chunk_scratch.resize(chunks);
+	if (chunks == 1) {
+		fn(0, 0, count);
+		return;
+	}
+	workers->run(chunks, [&](uint32_t chunk) {
+		fn(chunk, uint32_t(uint64_t(count) * chunk / chunks), uint32_t(uint64_t(count) * (chunk + 1) / chunks));
+	});
+}
+
 void Game::update(float elapsed) {
+	TRACE_ZONE("Game::update");
+	Trace::Zone phase("update: controls");
+
 	//change gravity
 	timer += elapsed;
 	while (timer >= interval) {
 		timer -= interval;
 		for (auto &p : players) {
-			int i = rand() % 100;
-			if (i % 2 == 0) {
+			if (rng() % 2 == 0) {
 				p.gravity *= -1;
 			} else {
 				p.movement_index = (p.movement_index + 1) % 2;
@@ -192,340 +445,722 @@ void Game::update(float elapsed) {
 		}
 	}
 
-	//shoot bullet
+	//shoot bullet (once per press -- even a press and release that both came in since the last tick)
 	for (auto &p : players) {
-		if (p.controls.shoot.pressed && !p.shoot_pressing && p.HP > 0) {
-			bullets.emplace_back();
-			bullets.back().position = p.position;
-			bullets.back().velocity = p.bullet_direction;
-			bullets.back().color = p.color;
-			p.shoot_pressing = true;
-		} else if (!p.controls.shoot.pressed) {
-			p.shoot_pressing = false;
+		bool press = (p.controls.shoot.downs > 0 || (p.controls.shoot.pressed && !p.shoot_pressing));
+		if (press && p.HP > 0) {
+			bullets.push(p.position, p.bullet_direction, p.color, next_bullet_id++);
 		}
+		p.shoot_pressing = p.controls.shoot.pressed;
 	}
 
-	//position/velocity update:
+	//this tick is one more step of each player's latest controls (see Player::Controls::simulated_step):
 	for (auto &p : players) {
-		if (p.controls.jump.pressed && !p.jump_pressing) {
-			if (p.gravity < 0.0f) {
-				p.acceleration = 3.0f; // have to be opposite sign as gravity
-			} else {
-				p.acceleration = -3.0f;
+		p.controls.held_ticks += 1;
+	}
+
+	//players in list order (for random access from worker threads and for the bullet/player grid):
+	grid_players.clear();
+	for (auto &p : players) {
+		grid_players.emplace_back(&p);
+	}
+
+	//per-player movement and collision resolution:
+	// (each player only reads static level data and writes its own state, so players can be handled in any order)
+	phase.next("update: move players");
+	for_each_chunk(uint32_t(grid_players.size()), [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+		std::vector< uint32_t > &nearby = chunk_scratch[chunk];
+		for (uint32_t i = begin; i < end; ++i) {
+			move_player(*grid_players[i], elapsed, &nearby);
+		}
+		for (uint32_t i = begin; i < end; ++i) {
+			constrain_player(*grid_players[i], elapsed, &nearby);
+		}
+	});
+
+	//bucket players for bullet/player tests:
+	phase.next("update: bucket players");
+	player_grid.build(uint32_t(grid_players.size()), [this](uint32_t i, glm::ivec2 *lo, glm::ivec2 *hi){
+		*lo = *hi = player_grid.cell(grid_players[i]->position);
+	});
+
+	//bullet position update + collision tests:
+	// (bullets don't affect each other and hits don't depend on HP, so every bullet's fate can be decided in parallel)
+	phase.next("update: advance bullets");
+	bullet_fates.resize(bullets.size());
+	for_each_chunk(uint32_t(bullets.size()), [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+		std::vector< uint32_t > &nearby = chunk_scratch[chunk];
+		for (uint32_t i = begin; i < end; ++i) {
+			bullet_fates[i] = advance_bullet(i, elapsed, &nearby);
+		}
+	});
+
+	//apply bullet fates:
+	// (in a fixed order on one thread, so damage and bullet order never depend on the thread count;
+	//  removed bullets are swapped with the last bullet, which is then handled in the same slot)
+	phase.next("update: apply bullet fates");
+	for (size_t i = 0; i < bullets.size(); /* later */) {
+		uint32_t fate = bullet_fates[i];
+		if (fate == BulletFlying) {
+			++i;
+			continue;
+		}
+		if (fate != BulletGone) {
+			Player &player = *grid_players[fate];
+			if (player.HP > 0) {
+				player.HP -= 10;
 			}
-			p.jump_pressing = true;
-		} else if (!p.controls.jump.pressed) {
-			p.jump_pressing = false;
 		}
+		bullet_fates[i] = bullet_fates[bullets.size() - 1];
+		bullet_fates.pop_back();
+		bullets.remove(i);
+	}
+	phase.end();
+	Trace::counter("bullets", double(bullets.size()));
+}
+
+uint32_t Game::advance_bullet(uint32_t i, float elapsed, std::vector< uint32_t > *nearby_platforms_) {
+	auto &nearby_platforms = *nearby_platforms_;
+
+	glm::vec2 &position = bullets.positions[i];
+	glm::vec2 const &velocity = bullets.velocities[i];
+	uint8_t color = bullets.colors[i];
+
+	glm::vec2 start = position;
+	step_bullet(&position, velocity, elapsed);
+
+	//bullet/arena collisions:
+	if (position.x < ArenaMin.x + BulletRadius
+		|| position.x > ArenaMax.x - BulletRadius
+		|| position.y < ArenaMin.y + BulletRadius
+		|| position.y > ArenaMax.y + BulletRadius ) {
+		return BulletGone;
+	}
+
+	//Platforms and players are tested against the whole path the bullet took this tick (not just where it ended up),
+	// so that fast bullets / long ticks can't tunnel through thin platforms or players.
+	// Anything touched at the end position (the old, non-swept test) always counts as a hit at t = 1.
+	glm::vec2 path_min = glm::min(start, position);
+	glm::vec2 path_max = glm::max(start, position);
+
+	//bullet/block collisions:
+	// (bullet box vs. platform == bullet center vs. platform grown by the bullet radius)
+	float platform_t = 2.0f; //(> 1 means no hit)
+	find_overlapping_platforms(QueryBox(path_min - glm::vec2(BulletRadius), path_max + glm::vec2(BulletRadius)), &nearby_platforms);
+	for (uint32_t pi : nearby_platforms) {
+		Platform const &platform = platforms[pi];
+		float t;
+		if (!sweep_point_box(start, position, platform.positionMin - glm::vec2(BulletRadius), platform.positionMax + glm::vec2(BulletRadius), &t)) {
+			float leftA = position.x - BulletRadius;
+			float rightA = position.x + BulletRadius;
+			float topA = position.y + BulletRadius;
+			float bottomA = position.y - BulletRadius;
+			if (!check_collision(leftA, platform.positionMin.x, rightA, platform.positionMax.x, topA, platform.positionMax.y, bottomA, platform.positionMin.y)) continue;
+			t = 1.0f;
+		}
+		platform_t = std::min(platform_t, t);
+	}
+
+	//bullet/player collisions:
+	// only players in cells overlapping the bullet's path (grown by hit distance) are tested;
+	// the player reached earliest is hit (ties go to the first player in 'players' order).
+	constexpr float Reach = PlayerRadius + BulletRadius + 1e-4f; //(padded so rounding can't drop a grazing hit)
+	glm::ivec2 lo = player_grid.cell(path_min - glm::vec2(Reach));
+	glm::ivec2 hi = player_grid.cell(path_max + glm::vec2(Reach));
+	uint32_t hit = BulletFlying;
+	float hit_t = platform_t; //(a player has to be reached strictly before any platform)
+	for (int y = lo.y; y <= hi.y; ++y) {
+		for (int x = lo.x; x <= hi.x; ++x) {
+			uint32_t c = player_grid.cell_index(glm::ivec2(x, y));
+			for (uint32_t e = player_grid.cell_start[c]; e < player_grid.cell_start[c+1]; ++e) {
+				uint32_t index = player_grid.entries[e];
+				Player const &player = *grid_players[index];
+				if (player.color == color) continue; //can't shoot yourself
+				float t;
+				if (!sweep_point_circle(start, position, player.position, PlayerRadius + BulletRadius, &t)) {
+					if (!bullet_touches_player(player.position.x - position.x, player.position.y - position.y)) continue;
+					t = 1.0f;
+				}
+				if (t < hit_t || (t == hit_t && hit != BulletFlying && index < hit)) {
+					hit = index;
+					hit_t = t;
+				}
+			}
+		}
+	}
+	if (hit != BulletFlying) return hit;
+	if (platform_t <= 1.0f) return BulletGone;
+	return BulletFlying;
+}
+
+void Game::move_player(Player &p, float elapsed, std::vector< uint32_t > *nearby_platforms_) const {
+	auto &nearby_platforms = *nearby_platforms_;
+
+	//jump once per press (even a press and release that both came in since the last tick):
+	if (p.controls.jump.downs > 0 || (p.controls.jump.pressed && !p.jump_pressing)) {
+		if (p.gravity < 0.0f) {
+			p.acceleration = 3.0f; // have to be opposite sign as gravity
+		} else {
+			p.acceleration = -3.0f;
+		}
+	}
+	p.jump_pressing = p.controls.jump.pressed;
+
+	//gravity-axis motion is split into steps short enough that the player can't pass through a platform:
+	// (a step that hits a platform ends the motion)
+	uint32_t steps = 1;
+	{
+		float distance = std::abs(p.acceleration * elapsed);
+		if (distance > PlayerMaxStep) {
+			steps = uint32_t(std::min(64.0f, std::ceil(distance / PlayerMaxStep)));
+		}
+	}
 
-		if (p.movement_index == 0) {
-			p.position.y += p.acceleration * elapsed;
-			bool collide = false;
+	if (p.movement_index == 0) {
+		bool collide = false;
+		for (uint32_t step = 0; step < steps && !collide; ++step) {
+			p.position.y += p.acceleration * elapsed / float(steps);
 			float leftA = p.position.x - PlayerRadius;
 			float rightA = p.position.x + PlayerRadius;
 			float topA = p.position.y + PlayerRadius;
 			float bottomA = p.position.y - PlayerRadius;
-			for (auto &platform : platforms) {
-				float leftB = platform.positionMin.x;
-				float rightB = platform.positionMax.x;
+			find_overlapping_platforms(QueryBox(glm::vec2(leftA, bottomA), glm::vec2(rightA, topA)), &nearby_platforms);
+			for (uint32_t pi : nearby_platforms) {
+				Platform const &platform = platforms[pi];
 				float topB = platform.positionMax.y;
 				float bottomB = platform.positionMin.y;
-				if (check_collision(leftA, leftB, rightA, rightB, topA, topB, bottomA, bottomB)) {
-					collide = true;
-					p.position.y -= p.acceleration * elapsed;
-					if (p.gravity < 0.0f) {
-						if (p.position.y < bottomB - PlayerRadius) {
-							p.position.y = bottomB - PlayerRadius - 0.001f;
-						} else {
-							p.position.y = topB + PlayerRadius + 0.001f;
-						}
+				collide = true;
+				p.position.y -= p.acceleration * elapsed / float(steps);
+				if (p.gravity < 0.0f) {
+					if (p.position.y < bottomB - PlayerRadius) {
+						p.position.y = bottomB - PlayerRadius - 0.001f;
+					} else {
+						p.position.y = topB + PlayerRadius + 0.001f;
+					}
+				} else {
+					if (p.position.y > topB + PlayerRadius) {
+						p.position.y = topB + PlayerRadius + 0.001f;
 					} else {
-						if (p.position.y > topB + PlayerRadius) {
-							p.position.y = topB + PlayerRadius + 0.001f;
-						} else {
-							p.position.y = bottomB - PlayerRadius - 0.001f;
-						}
+						p.position.y = bottomB - PlayerRadius - 0.001f;
 					}
-					p.acceleration = 0.0f;
 				}
+				p.acceleration = 0.0f;
 			}
-			if (!collide) {
-				p.acceleration += p.gravity * elapsed;
-			}
+		}
+		if (!collide) {
+			p.acceleration += p.gravity * elapsed;
+		}
 
-			if (p.controls.left.pressed && !p.controls.right.pressed) {
-				p.position.x -= p.velocity.x * elapsed;
-			} else if (!p.controls.left.pressed && p.controls.right.pressed) {
-				p.position.x += p.velocity.x * elapsed;
-			} 
-		} else {
-			p.position.x += p.acceleration * elapsed;
-			bool collide = false;
+		if (p.controls.left.pressed && !p.controls.right.pressed) {
+			p.position.x -= p.velocity.x * elapsed;
+		} else if (!p.controls.left.pressed && p.controls.right.pressed) {
+			p.position.x += p.velocity.x * elapsed;
+		} 
+	} else {
+		bool collide = false;
+		for (uint32_t step = 0; step < steps && !collide; ++step) {
+			p.position.x += p.acceleration * elapsed / float(steps);
 			float leftA = p.position.x - PlayerRadius;
 			float rightA = p.position.x + PlayerRadius;
 			float topA = p.position.y + PlayerRadius;
 			float bottomA = p.position.y - PlayerRadius;
-			for (auto &platform : platforms) {
+			find_overlapping_platforms(QueryBox(glm::vec2(leftA, bottomA), glm::vec2(rightA, topA)), &nearby_platforms);
+			for (uint32_t pi : nearby_platforms) {
+				Platform const &platform = platforms[pi];
 				float leftB = platform.positionMin.x;
 				float rightB = platform.positionMax.x;
-				float topB = platform.positionMax.y;
-				float bottomB = platform.positionMin.y;
-				if (check_collision(leftA, leftB, rightA, rightB, topA, topB, bottomA, bottomB)) {
-					collide = true;
-					p.position.x -= p.acceleration * elapsed;
-					if (p.gravity < 0.0f) {
-						if (p.position.x < leftB - PlayerRadius) {
-							p.position.x = leftB - PlayerRadius - 0.001f;
-						} else {
-							p.position.x = rightB + PlayerRadius + 0.001f;
-						}
+				collide = true;
+				p.position.x -= p.acceleration * elapsed / float(steps);
+				if (p.gravity < 0.0f) {
+					if (p.position.x < leftB - PlayerRadius) {
+						p.position.x = leftB - PlayerRadius - 0.001f;
+					} else {
+						p.position.x = rightB + PlayerRadius + 0.001f;
+					}
+				} else {
+					if (p.position.x > rightB + PlayerRadius) {
+						p.position.x = rightB + PlayerRadius + 0.001f;
 					} else {
-						if (p.position.x > rightB + PlayerRadius) {
-							p.position.x = rightB + PlayerRadius + 0.001f;
-						} else {
-							p.position.x = leftB - PlayerRadius - 0.001f;
-						}
+						p.position.x = leftB - PlayerRadius - 0.001f;
 					}
-					
-					p.acceleration = 0.0f;
 				}
-			}
-			if (!collide) {
-				p.acceleration += p.gravity * elapsed;
-			}
 			
-			if (p.controls.down.pressed && !p.controls.up.pressed) {
-				p.position.y -= p.velocity.y * elapsed;
-			} else if (!p.controls.down.pressed && p.controls.up.pressed) {
-				p.position.y += p.velocity.y * elapsed;
-			} 
+				p.acceleration = 0.0f;
+			}
+		}
+		if (!collide) {
+			p.acceleration += p.gravity * elapsed;
 		}
+		
+		if (p.controls.down.pressed && !p.controls.up.pressed) {
+			p.position.y -= p.velocity.y * elapsed;
+		} else if (!p.controls.down.pressed && p.controls.up.pressed) {
+			p.position.y += p.velocity.y * elapsed;
+		} 
+	}
+
+	//reset 'downs' since controls have been handled:
+	p.controls.left.downs = 0;
+	p.controls.right.downs = 0;
+	p.controls.up.downs = 0;
+	p.controls.down.downs = 0;
+	p.controls.jump.downs = 0;
+	p.controls.shoot.downs = 0;
 
-		//reset 'downs' since controls have been handled:
-		p.controls.left.downs = 0;
-		p.controls.right.downs = 0;
-		p.controls.up.downs = 0;
-		p.controls.down.downs = 0;
-		p.controls.jump.downs = 0;
-		p.controls.shoot.downs = 0;
+}
+
+void Game::constrain_player(Player &p1, float elapsed, std::vector< uint32_t > *nearby_platforms_) const {
+	auto &nearby_platforms = *nearby_platforms_;
+
+	if (p1.movement_index == 0) {
+		if (p1.controls.left.pressed && !p1.controls.right.pressed) {
+			p1.bullet_direction = glm::vec2(-BulletSpeed, 0.0f);
+		} else if (!p1.controls.left.pressed && p1.controls.right.pressed) {
+			p1.bullet_direction = glm::vec2(BulletSpeed, 0.0f);
+		} else if (p1.controls.down.pressed && !p1.controls.up.pressed) {
+			p1.bullet_direction = glm::vec2(0.0f, -BulletSpeed);
+		} else if (!p1.controls.down.pressed && p1.controls.up.pressed) {
+			p1.bullet_direction = glm::vec2(0.0f, BulletSpeed);
+		} 
+	} else {
+		if (p1.controls.down.pressed && !p1.controls.up.pressed) {
+			p1.bullet_direction = glm::vec2(0.0f, -BulletSpeed);
+		} else if (!p1.controls.down.pressed && p1.controls.up.pressed) {
+			p1.bullet_direction = glm::vec2(0.0f, BulletSpeed);
+		} else if (p1.controls.left.pressed && !p1.controls.right.pressed) {
+			p1.bullet_direction = glm::vec2(-BulletSpeed, 0.0f);
+		} else if (!p1.controls.left.pressed && p1.controls.right.pressed) {
+			p1.bullet_direction = glm::vec2(BulletSpeed, 0.0f);
+		} 
 	}
 
-	//collision resolution:
-	for (auto &p1 : players) {
+	// TODO: player/player collisions:
+	// for (auto &p2 : players) {
+	// 	if (&p1 == &p2) break;
+	// 	glm::vec2 p12 = p2.position - p1.position;
+	// 	float len2 = glm::length2(p12);
+	// 	if (len2 > (2.0f * PlayerRadius) * (2.0f * PlayerRadius)) continue;
+	// 	if (len2 == 0.0f) continue;
+	// 	glm::vec2 dir = p12 / std::sqrt(len2);
+	// 	//mirror velocity to be in separating direction:
+	// 	glm::vec2 v12 = p2.velocity - p1.velocity;
+	// 	glm::vec2 delta_v12 = dir * glm::max(0.0f, -1.75f * glm::dot(dir, v12));
+	// 	p2.velocity += 0.5f * delta_v12;
+	// 	p1.velocity -= 0.5f * delta_v12;
+	// }
+
+	//player/block collisions:
+	float leftA = p1.position.x - PlayerRadius;
+	float rightA = p1.position.x + PlayerRadius;
+	float topA = p1.position.y + PlayerRadius;
+	float bottomA = p1.position.y - PlayerRadius;
+	find_overlapping_platforms(QueryBox(glm::vec2(leftA, bottomA), glm::vec2(rightA, topA)), &nearby_platforms);
+	for (uint32_t pi : nearby_platforms) {
+		Platform const &platform = platforms[pi];
+		float leftB = platform.positionMin.x;
+		float rightB = platform.positionMax.x;
+		float topB = platform.positionMax.y;
+		float bottomB = platform.positionMin.y;
 		if (p1.movement_index == 0) {
 			if (p1.controls.left.pressed && !p1.controls.right.pressed) {
-				p1.bullet_direction = glm::vec2(-2.0f, 0.0f);
+				p1.position.x += p1.velocity.x * elapsed;
+				if (p1.position.x > rightB + PlayerRadius) {
+					p1.position.x = rightB + PlayerRadius;
+				}
 			} else if (!p1.controls.left.pressed && p1.controls.right.pressed) {
-				p1.bullet_direction = glm::vec2(2.0f, 0.0f);
-			} else if (p1.controls.down.pressed && !p1.controls.up.pressed) {
-				p1.bullet_direction = glm::vec2(0.0f, -2.0f);
-			} else if (!p1.controls.down.pressed && p1.controls.up.pressed) {
-				p1.bullet_direction = glm::vec2(0.0f, 2.0f);
+				p1.position.x -= p1.velocity.x * elapsed;
+				if (p1.position.x < leftB - PlayerRadius) {
+					p1.position.x = leftB - PlayerRadius;
+				}
 			} 
 		} else {
 			if (p1.controls.down.pressed && !p1.controls.up.pressed) {
-				p1.bullet_direction = glm::vec2(0.0f, -2.0f);
+				p1.position.y += p1.velocity.y * elapsed;
+				if (p1.position.y > topB + PlayerRadius) {
+					p1.position.y = topB + PlayerRadius;
+				}
 			} else if (!p1.controls.down.pressed && p1.controls.up.pressed) {
-				p1.bullet_direction = glm::vec2(0.0f, 2.0f);
-			} else if (p1.controls.left.pressed && !p1.controls.right.pressed) {
-				p1.bullet_direction = glm::vec2(-2.0f, 0.0f);
-			} else if (!p1.controls.left.pressed && p1.controls.right.pressed) {
-				p1.bullet_direction = glm::vec2(2.0f, 0.0f);
+				p1.position.y -= p1.velocity.y * elapsed;
+				if (p1.position.y < bottomB - PlayerRadius) {
+					p1.position.y = bottomB - PlayerRadius;
+				}
 			} 
 		}
+	}
 
-		// TODO: player/player collisions:
-		// for (auto &p2 : players) {
-		// 	if (&p1 == &p2) break;
-		// 	glm::vec2 p12 = p2.position - p1.position;
-		// 	float len2 = glm::length2(p12);
-		// 	if (len2 > (2.0f * PlayerRadius) * (2.0f * PlayerRadius)) continue;
-		// 	if (len2 == 0.0f) continue;
-		// 	glm::vec2 dir = p12 / std::sqrt(len2);
-		// 	//mirror velocity to be in separating direction:
-		// 	glm::vec2 v12 = p2.velocity - p1.velocity;
-		// 	glm::vec2 delta_v12 = dir * glm::max(0.0f, -1.75f * glm::dot(dir, v12));
-		// 	p2.velocity += 0.5f * delta_v12;
-		// 	p1.velocity -= 0.5f * delta_v12;
-		// }
-
-		//player/block collisions:
-		float leftA = p1.position.x - PlayerRadius;
-		float rightA = p1.position.x + PlayerRadius;
-		float topA = p1.position.y + PlayerRadius;
-		float bottomA = p1.position.y - PlayerRadius;
-		for (auto &platform : platforms) {
-			float leftB = platform.positionMin.x;
-			float rightB = platform.positionMax.x;
-			float topB = platform.positionMax.y;
-			float bottomB = platform.positionMin.y;
-			if (check_collision(leftA, leftB, rightA, rightB, topA, topB, bottomA, bottomB)) {
-				if (p1.movement_index == 0) {
-					if (p1.controls.left.pressed && !p1.controls.right.pressed) {
-						p1.position.x += p1.velocity.x * elapsed;
-						if (p1.position.x > rightB + PlayerRadius) {
-							p1.position.x = rightB + PlayerRadius;
-						}
-					} else if (!p1.controls.left.pressed && p1.controls.right.pressed) {
-						p1.position.x -= p1.velocity.x * elapsed;
-						if (p1.position.x < leftB - PlayerRadius) {
-							p1.position.x = leftB - PlayerRadius;
-						}
-					} 
-				} else {
-					if (p1.controls.down.pressed && !p1.controls.up.pressed) {
-						p1.position.y += p1.velocity.y * elapsed;
-						if (p1.position.y > topB + PlayerRadius) {
-							p1.position.y = topB + PlayerRadius;
-						}
-					} else if (!p1.controls.down.pressed && p1.controls.up.pressed) {
-						p1.position.y -= p1.velocity.y * elapsed;
-						if (p1.position.y < bottomB - PlayerRadius) {
-							p1.position.y = bottomB - PlayerRadius;
-						}
-					} 
-				}
-			}
+	//player/arena collisions:
+	if (p1.position.x < ArenaMin.x + PlayerRadius) {
+		p1.position.x = ArenaMin.x + PlayerRadius;
+		if (p1.movement_index == 1) {
+			p1.acceleration = 0.0f;
+		}
+	}
+	if (p1.position.x > ArenaMax.x - PlayerRadius) {
+		p1.position.x = ArenaMax.x - PlayerRadius;
+		if (p1.movement_index == 1) {
+			p1.acceleration = 0.0f;
 		}
+	}
+	if (p1.position.y < ArenaMin.y + PlayerRadius) {
+		p1.position.y = ArenaMin.y + PlayerRadius;
+		if (p1.movement_index == 0) {
+			p1.acceleration = 0.0f;
+		}
+	}
+	if (p1.position.y > ArenaMax.y - PlayerRadius) {
+		p1.position.y = ArenaMax.y - PlayerRadius;
+		if (p1.movement_index == 0) {
+			p1.acceleration = 0.0f;
+		}
+	}
 
-		//player/arena collisions:
-		if (p1.position.x < ArenaMin.x + PlayerRadius) {
-			p1.position.x = ArenaMin.x + PlayerRadius;
-			if (p1.movement_index == 1) {
-				p1.acceleration = 0.0f;
-			}
+}
+
+//---- snapshots and (delta-encoded, quantized) state messages ----
+//
+//State message body:
+//  u32 tick, u32 baseline tick (NoTick for a full snapshot), f32 step
+//  players:
+//    varint count, then ids of baseline players that are gone (as gaps between ascending ids)
+//    varint count, then for each new or changed player (ascending id): varint id gap, u8 field mask, masked fields:
+//      position: 2x u16 fixed point; velocity: 2x i16 8.8 fixed point; color: u8 palette index; HP: zig-zag varint
+//      (gravity has no bytes of its own -- its two bits ride in the top of the field mask)
+//  bullets: same layout, fields:
+//      position: 2x u16 fixed point (2x f32 if it has been moved along since it was snapped to the grid -- see record_snapshot);
+//      velocity: none for the four axis directions (two bits in the mask), else 2x f32; color: u8
+//Anything not mentioned is unchanged from the baseline -- except that bullets are moved along by
+//step_bullet() once per tick, and their position is only sent if it doesn't match that prediction exactly.
+
+namespace {
+	enum PlayerField : uint8_t {
+		PlayerPosition = 1 << 0,
+		PlayerVelocity = 1 << 1,
+		PlayerColor = 1 << 2,
+		PlayerGravity = 1 << 3,
+		PlayerHP = 1 << 4,
+		PlayerAll = 0x1f,
+		PlayerGravityShift = 6, //(gravity bits, when PlayerGravity is set)
+	};
+	enum BulletField : uint8_t {
+		BulletPosition = 1 << 0,
+		BulletVelocity = 1 << 1,
+		BulletColor = 1 << 2,
+		BulletAll = 0x07,
+		BulletVelocityRaw = 1 << 3, //(velocity isn't one of the four directions; floats follow)
+		BulletDirectionShift = 4, //(direction, when BulletVelocity is set and BulletVelocityRaw isn't)
+		BulletPositionRaw = 1 << 6, //(position isn't on the fixed-point grid -- it has been moved along since it was -- so floats follow)
+	};
+
+	//bullet velocities sent as a two-bit direction:
+	glm::vec2 const BulletDirections[4] = {
+		glm::vec2( Game::BulletSpeed, 0.0f),
+		glm::vec2(-Game::BulletSpeed, 0.0f),
+		glm::vec2(0.0f,  Game::BulletSpeed),
+		glm::vec2(0.0f, -Game::BulletSpeed),
+	};
+
+	//bit-for-bit comparison (so the decoded state matches exactly, even for -0 and NaN):
+	template< typename T >
+	bool same(T const &a, T const &b) {
+		return std::memcmp(&a, &b, sizeof(T)) == 0;
+	}
+
+	uint8_t changed_fields(Snapshot::PlayerState const &from, Snapshot::PlayerState const &to) {
+		uint8_t mask = 0;
+		if (!same(from.position, to.position)) mask |= PlayerPosition;
+		if (!same(from.velocity, to.velocity)) mask |= PlayerVelocity;
+		if (from.color != to.color) mask |= PlayerColor;
+		if (from.gravity != to.gravity) mask |= PlayerGravity;
+		if (from.HP != to.HP) mask |= PlayerHP;
+		return mask;
+	}
+
+	//where a baseline bullet should be after 'ticks' more ticks:
+	glm::vec2 predict_bullet(Snapshot::BulletState const &from, uint32_t ticks, float step) {
+		glm::vec2 position = from.position;
+		for (uint32_t t = 0; t < ticks; ++t) {
+			Game::step_bullet(&position, from.velocity, step);
 		}
-		if (p1.position.x > ArenaMax.x - PlayerRadius) {
-			p1.position.x = ArenaMax.x - PlayerRadius;
-			if (p1.movement_index == 1) {
-				p1.acceleration = 0.0f;
-			}
+		return position;
+	}
+
+	uint8_t changed_fields(Snapshot::BulletState const &from, Snapshot::BulletState const &to, uint32_t ticks, float step) {
+		uint8_t mask = 0;
+		if (!same(predict_bullet(from, ticks, step), to.position)) mask |= BulletPosition;
+		if (!same(from.velocity, to.velocity)) mask |= BulletVelocity;
+		if (from.color != to.color) mask |= BulletColor;
+		return mask;
+	}
+
+	//8.8 fixed point:
+	int16_t quantize_velocity(float velocity) {
+		float v = std::round(velocity * 256.0f);
+		if (!(v > -32768.0f)) return -32768; //(also catches NaN)
+		if (v > 32767.0f) return 32767;
+		return int16_t(v);
+	}
+	float dequantize_velocity(int16_t velocity) {
+		return float(velocity) / 256.0f;
+	}
+
+	//so small negative numbers stay small as varints:
+	uint32_t zigzag(int32_t value) {
+		return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+	}
+	int32_t unzigzag(uint32_t value) {
+		return int32_t(value >> 1) ^ -int32_t(value & 1);
+	}
+}
+
+uint16_t Snapshot::quantize_position(float position, int axis) {
+	float min = Game::ArenaMin[axis] - PositionMargin;
+	float max = Game::ArenaMax[axis] + PositionMargin;
+	float q = std::round((position - min) / (max - min) * 65535.0f);
+	if (!(q > 0.0f)) return 0; //(also catches NaN)
+	if (q > 65535.0f) return 65535;
+	return uint16_t(q);
+}
+
+float Snapshot::dequantize_position(uint16_t position, int axis) {
+	float min = Game::ArenaMin[axis] - PositionMargin;
+	float max = Game::ArenaMax[axis] + PositionMargin;
+	return min + (max - min) * (float(position) / 65535.0f);
+}
+
+Snapshot const *Game::find_snapshot(uint32_t tick) const {
+	if (tick == Snapshot::NoTick) return nullptr;
+	Snapshot const &snapshot = snapshots[tick % SnapshotHistory];
+	if (snapshot.tick != tick) return nullptr;
+	return &snapshot;
+}
+
+uint32_t Game::record_snapshot(float step) {
+	Snapshot const *previous = find_snapshot(snapshot_tick);
+
+	snapshot_tick += 1;
+	if (snapshot_tick == Snapshot::NoTick) snapshot_tick += 1; //(skip NoTick on wrap-around)
+
+	Snapshot &snapshot = snapshots[snapshot_tick % SnapshotHistory];
+	assert(&snapshot != previous);
+	snapshot.tick = snapshot_tick;
+	snapshot.step = step;
+
+	//(re-uses the storage of the snapshot this replaces)
+	snapshot.players.resize(players.size());
+	size_t i = 0;
+	for (auto const &player : players) {
+		Snapshot::PlayerState &state = snapshot.players[i++];
+		state.id = player.id;
+		for (int axis = 0; axis < 2; ++axis) {
+			state.position[axis] = Snapshot::quantize_position(player.position[axis], axis);
+			state.velocity[axis] = quantize_velocity(player.velocity[axis]);
 		}
-		if (p1.position.y < ArenaMin.y + PlayerRadius) {
-			p1.position.y = ArenaMin.y + PlayerRadius;
-			if (p1.movement_index == 0) {
-				p1.acceleration = 0.0f;
-			}
+		state.color = player.color;
+		state.gravity = uint8_t((player.movement_index & 1) | (player.gravity > 0.0f ? 2 : 0));
+		state.HP = player.HP;
+	}
+	std::sort(snapshot.players.begin(), snapshot.players.end(), [](auto const &a, auto const &b){ return a.id < b.id; });
+
+	snapshot.bullets.resize(bullets.size());
+	for (size_t b = 0; b < bullets.size(); ++b) {
+		Snapshot::BulletState &state = snapshot.bullets[b];
+		state.id = bullets.ids[b];
+		state.position = bullets.positions[b];
+		state.velocity = bullets.velocities[b];
+		state.color = bullets.colors[b];
+	}
+	std::sort(snapshot.bullets.begin(), snapshot.bullets.end(), [](auto const &a, auto const &b){ return a.id < b.id; });
+
+	//bullet positions are stored as the client will have them: moved along from the previous tick with step_bullet
+	// (which costs no bytes to send), and only snapped back to the quantized real position once that drifts more than a step away:
+	glm::vec2 quantum;
+	for (int axis = 0; axis < 2; ++axis) {
+		quantum[axis] = (ArenaMax[axis] - ArenaMin[axis] + 2.0f * Snapshot::PositionMargin) / 65535.0f;
+	}
+	size_t p = 0;
+	for (auto &bullet : snapshot.bullets) {
+		glm::vec2 real = bullet.position;
+		if (previous) {
+			while (p < previous->bullets.size() && previous->bullets[p].id < bullet.id) ++p;
 		}
-		if (p1.position.y > ArenaMax.y - PlayerRadius) {
-			p1.position.y = ArenaMax.y - PlayerRadius;
-			if (p1.movement_index == 0) {
-				p1.acceleration = 0.0f;
-			}
+		if (previous && p < previous->bullets.size() && previous->bullets[p].id == bullet.id && same(previous->bullets[p].velocity, bullet.velocity)) {
+			bullet.position = predict_bullet(previous->bullets[p], 1, step);
+			if (std::abs(bullet.position.x - real.x) <= quantum.x && std::abs(bullet.position.y - real.y) <= quantum.y) continue;
+		}
+		for (int axis = 0; axis < 2; ++axis) {
+			bullet.position[axis] = Snapshot::dequantize_position(Snapshot::quantize_position(real[axis], axis), axis);
 		}
 	}
 
-	//bullet position update
-	// https://stackoverflow.com/a/596180
-	std::list<Bullet>::iterator iter = bullets.begin();
-	while (iter != bullets.end()) {
-		(*iter).position.x += elapsed * (*iter).velocity.x;
-		(*iter).position.y += elapsed * (*iter).velocity.y;
+	return snapshot_tick;
+}
 
-		//bullet/arena collisions:
-		if ((*iter).position.x < ArenaMin.x + BulletRadius 
-			|| (*iter).position.x > ArenaMax.x - BulletRadius
-			|| (*iter).position.y < ArenaMin.y + BulletRadius
-			|| (*iter).position.y > ArenaMax.y + BulletRadius ) {
-			iter = bullets.erase(iter);
-		} else {
-			//bullet/block collisions:
-			float leftA = (*iter).position.x - BulletRadius;
-			float rightA = (*iter).position.x + BulletRadius;
-			float topA = (*iter).position.y + BulletRadius;
-			float bottomA = (*iter).position.y - BulletRadius;
-			bool collide = false;
-			for (auto &platform : platforms) {
-				float leftB = platform.positionMin.x;
-				float rightB = platform.positionMax.x;
-				float topB = platform.positionMax.y;
-				float bottomB = platform.positionMin.y;
-				if (check_collision(leftA, leftB, rightA, rightB, topA, topB, bottomA, bottomB)) {
-					collide = true;
-					break;
+SharedBytes Game::encode_state_body(uint32_t tick, uint32_t baseline_tick) const {
+	TRACE_ZONE("Game::encode_state_body");
+	Snapshot const *snapshot_ = find_snapshot(tick);
+	assert(snapshot_ && "encode_state_body: tick isn't in history.");
+	Snapshot const &snapshot = *snapshot_;
+	Snapshot const *baseline = (baseline_tick < tick ? find_snapshot(baseline_tick) : nullptr);
+	static Snapshot const Empty;
+	Snapshot const &from = (baseline ? *baseline : Empty);
+	uint32_t ticks = (baseline ? tick - baseline->tick : 0);
+
+	auto body = std::make_shared< std::vector< uint8_t > >();
+
+	auto send = [&](auto const &val) {
+		uint8_t const *bytes = reinterpret_cast< uint8_t const * >(&val);
+		body->insert(body->end(), bytes, bytes + sizeof(val));
+	};
+	auto send_varint = [&](uint32_t val) {
+		while (val >= 0x80) {
+			body->emplace_back(uint8_t(val | 0x80));
+			val >>= 7;
+		}
+		body->emplace_back(uint8_t(val));
+	};
+
+	send(snapshot.tick);
+	send(baseline ? baseline->tick : Snapshot::NoTick);
+	send(snapshot.step);
+
+	//walk 'from' and 'to' (both sorted by id) together, sending removed ids and then new/changed entities:
+	auto send_changes = [&](auto const &from_list, auto const &to_list, auto const &fields, auto const &send_fields) {
+		uint32_t removed = 0;
+		uint32_t changed = 0;
+		{ //count first, so counts can go before the lists:
+			size_t f = 0;
+			for (auto const &to : to_list) {
+				while (f < from_list.size() && from_list[f].id < to.id) { ++removed; ++f; }
+				if (f < from_list.size() && from_list[f].id == to.id) {
+					if (fields(from_list[f], to)) ++changed;
+					++f;
+				} else {
+					++changed;
 				}
 			}
-			if (collide) {
-				iter = bullets.erase(iter);
-			} else {
-				//bullet/player collisions:
-				bool collide2 = false;
-				for (auto &player : players) {
-					float dist = (float) std::sqrt(
-						std::pow(player.position.x - (*iter).position.x, 2) + 
-						std::pow(player.position.y - (*iter).position.y, 2));
-					if (dist < PlayerRadius + BulletRadius && player.color != (*iter).color) {
-						collide2 = true;
-						if (player.HP > 0) {
-							player.HP -= 10;
-						}
-						break;
-					}
-				} if (collide2) {
-					iter = bullets.erase(iter);
-				} else {
-					++iter;
+			removed += uint32_t(from_list.size() - f);
+		}
+
+		send_varint(removed);
+		uint32_t previous = 0;
+		{
+			size_t f = 0;
+			for (auto const &to : to_list) {
+				while (f < from_list.size() && from_list[f].id < to.id) {
+					send_varint(from_list[f].id - previous);
+					previous = from_list[f].id;
+					++f;
 				}
+				if (f < from_list.size() && from_list[f].id == to.id) ++f;
+			}
+			for (; f < from_list.size(); ++f) {
+				send_varint(from_list[f].id - previous);
+				previous = from_list[f].id;
 			}
 		}
-	}
-}
 
+		send_varint(changed);
+		previous = 0;
+		{
+			size_t f = 0;
+			for (auto const &to : to_list) {
+				while (f < from_list.size() && from_list[f].id < to.id) ++f;
+				uint8_t mask = 0xff; //(new: send everything)
+				if (f < from_list.size() && from_list[f].id == to.id) {
+					mask = fields(from_list[f], to);
+					++f;
+				}
+				if (mask == 0) continue;
+				send_varint(to.id - previous);
+				previous = to.id;
+				send_fields(mask, to);
+			}
+		}
+	};
 
-void Game::send_state_message(Connection *connection_, Player *connection_player) const {
-	assert(connection_);
-	auto &connection = *connection_;
+	send_changes(from.players, snapshot.players,
+		[&](Snapshot::PlayerState const &a, Snapshot::PlayerState const &b) { return changed_fields(a, b); },
+		[&](uint8_t mask, Snapshot::PlayerState const &player) {
+			mask &= PlayerAll;
+			if (mask & PlayerGravity) mask |= uint8_t(player.gravity << PlayerGravityShift);
+			send(mask);
+			if (mask & PlayerPosition) send(player.position);
+			if (mask & PlayerVelocity) send(player.velocity);
+			if (mask & PlayerColor) send(player.color);
+			if (mask & PlayerHP) send_varint(zigzag(player.HP));
+		}
+	);
+
+	send_changes(from.bullets, snapshot.bullets,
+		[&](Snapshot::BulletState const &a, Snapshot::BulletState const &b) { return changed_fields(a, b, ticks, snapshot.step); },
+		[&](uint8_t mask, Snapshot::BulletState const &bullet) {
+			mask &= BulletAll;
+			if (mask & BulletVelocity) {
+				uint8_t direction = 0;
+				while (direction < 4 && !same(bullet.velocity, BulletDirections[direction])) ++direction;
+				if (direction < 4) mask |= uint8_t(direction << BulletDirectionShift);
+				else mask |= BulletVelocityRaw;
+			}
+			uint16_t position[2];
+			if (mask & BulletPosition) {
+				for (int axis = 0; axis < 2; ++axis) {
+					position[axis] = Snapshot::quantize_position(bullet.position[axis], axis);
+					if (!same(Snapshot::dequantize_position(position[axis], axis), bullet.position[axis])) mask |= BulletPositionRaw;
+				}
+			}
+			send(mask);
+			if (mask & BulletPositionRaw) send(bullet.position);
+			else if (mask & BulletPosition) send(position);
+			if (mask & BulletVelocityRaw) send(bullet.velocity);
+			if (mask & BulletColor) send(bullet.color);
+		}
+	);
 
-	connection.send(Message::S2C_State);
-	//will patch message size in later, for now placeholder bytes:
-	connection.send(uint8_t(0));
-	connection.send(uint8_t(0));
-	connection.send(uint8_t(0));
-	size_t mark = connection.send_buffer.size(); //keep track of this position in the buffer
-
-
-	//send player info helper:
-	auto send_player = [&](Player const &player) {
-		connection.send(player.position);
-		connection.send(player.velocity);
-		connection.send(player.color);
-		connection.send(player.movement_index);
-		connection.send(player.gravity);
-		connection.send(player.HP);
-	
-		//NOTE: can't just 'send(name)' because player.name is not plain-old-data type.
-		//effectively: truncates player name to 255 chars
-		uint8_t len = uint8_t(std::min< size_t >(255, player.name.size()));
-		connection.send(len);
-		connection.send_buffer.insert(connection.send_buffer.end(), player.name.begin(), player.name.begin() + len);
-	};
+	return body;
+}
 
-	//send bullet info helper:
-	auto send_bullet = [&](Bullet const &bullet) {
-		connection.send(bullet.position);
-		connection.send(bullet.velocity);
-		connection.send(bullet.color);
-	};
+uint32_t Game::encode_state_head(SharedBytes const &body, Player const *connection_player, uint8_t head[StateHeadSize]) {
+	assert(body);
 
-	//player count:
-	connection.send(uint8_t(players.size()));
-	if (connection_player) send_player(*connection_player);
-	for (auto const &player : players) {
-		if (&player == connection_player) continue;
-		send_player(player);
+	//per-recipient header:
+	// u32 own player id (0 if none), then, if there is one:
+	// u32 controls step simulated through, 2x f32 position, f32 acceleration, u8 flags (bit 0: jump_pressing, bit 1: shoot_pressing)
+	uint32_t at = 4;
+	auto put = [&](auto const &value) {
+		std::memcpy(head + at, &value, sizeof(value));
+		at += sizeof(value);
+	};
+	if (connection_player) {
+		Player const &player = *connection_player;
+		put(player.id);
+		put(player.controls.simulated_step());
+		put(player.position);
+		put(player.acceleration);
+		put(uint8_t((player.jump_pressing ? 1 : 0) | (player.shoot_pressing ? 2 : 0)));
+	} else {
+		put(uint32_t(0));
 	}
+	size_t size = (at - 4) + body->size();
+	if (size >= (1 << 24)) throw std::runtime_error("State message too large.");
+	head[0] = uint8_t(Message::S2C_State);
+	head[1] = uint8_t(size);
+	head[2] = uint8_t(size >> 8);
+	head[3] = uint8_t(size >> 16);
+	return at;
+}
 
-	//bullet count:
-	connection.send(uint8_t(bullets.size()));
-	for (auto const &bullet : bullets) {
-		send_bullet(bullet);
-	}
+void Game::send_state_message(Connection *connection_, SharedBytes const &body, Player const *connection_player) {
+	TRACE_ZONE("Game::send_state_message");
+	assert(connection_);
+	auto &connection = *connection_;
+
+	static_assert(StateHeadSize <= Connection::SharedSend::MaxHead, "state message header fits in a shared send's head");
+	uint8_t head[StateHeadSize];
+	uint32_t at = encode_state_head(body, connection_player, head);
 
-	//compute the message size and patch into the message header:
-	uint32_t size = uint32_t(connection.send_buffer.size() - mark);
-	connection.send_buffer[mark-3] = uint8_t(size);
-	connection.send_buffer[mark-2] = uint8_t(size >> 8);
-	connection.send_buffer[mark-1] = uint8_t(size >> 16);
+	//only the newest state matters, so if an older one is still waiting to go out (the recipient isn't keeping up), it is replaced:
+	// (the recipient only acknowledges -- and so the server only uses as baselines -- states it actually got, so any can be skipped)
+	connection.send_latest(head, at, body);
 }
 
 bool Game::recv_state_message(Connection *connection_) {
@@ -542,6 +1177,20 @@ bool Game::recv_state_message(Connection *connection_) {
 	//expecting complete message:
 	if (recv_buffer.size() < 4 + size) return false;
 
+	//if a newer state message has arrived too, skip this one without decoding it
+	// (safe because only decoded ticks are acknowledged, so the server won't have used this one as a baseline):
+	for (size_t next = 4 + size; next + 4 <= recv_buffer.size(); ) {
+		uint32_t next_size = (uint32_t(recv_buffer[next + 3]) << 16)
+		                   | (uint32_t(recv_buffer[next + 2]) << 8)
+		                   |  uint32_t(recv_buffer[next + 1]);
+		if (next + 4 + next_size > recv_buffer.size()) break; //(not all here yet)
+		if (recv_buffer[next] == uint8_t(Message::S2C_State)) {
+			recv_buffer.consume(4 + size);
+			return true;
+		}
+		next += 4 + next_size;
+	}
+
 	//copy bytes from buffer and advance position:
 	auto read = [&](auto *val) {
 		if (at + sizeof(*val) > size) {
@@ -550,45 +1199,326 @@ bool Game::recv_state_message(Connection *connection_) {
 		std::memcpy(val, &recv_buffer[4 + at], sizeof(*val));
 		at += sizeof(*val);
 	};
+	auto read_varint = [&]() {
+		uint32_t val = 0;
+		for (uint32_t shift = 0; ; shift += 7) {
+			uint8_t byte;
+			read(&byte);
+			if (shift > 28) throw std::runtime_error("Overlong varint in state message.");
+			val |= uint32_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) break;
+		}
+		return val;
+	};
 
+	uint32_t own_id;
+	read(&own_id);
+	uint32_t own_sequence = 0;
+	glm::vec2 own_position = glm::vec2(0.0f);
+	float own_acceleration = 0.0f;
+	uint8_t own_flags = 0;
+	if (own_id != 0) {
+		read(&own_sequence);
+		read(&own_position);
+		read(&own_acceleration);
+		read(&own_flags);
+	}
+
+	Snapshot &snapshot = decoded;
+	uint32_t baseline_tick;
+	read(&snapshot.tick);
+	read(&baseline_tick);
+	read(&snapshot.step);
+	if (snapshot.tick == Snapshot::NoTick) throw std::runtime_error("State message without a tick.");
+
+	//(on unreliable connections a state message can arrive after a newer one; it is no use now)
+	if (snapshot.tick <= snapshot_tick) {
+		recv_buffer.consume(4 + size);
+		return true;
+	}
+
+	//start from the baseline (or nothing):
+	Snapshot const *baseline = nullptr;
+	if (baseline_tick != Snapshot::NoTick) {
+		baseline = find_snapshot(baseline_tick);
+		if (!baseline || baseline_tick >= snapshot.tick) throw std::runtime_error("State message relative to unknown tick " + std::to_string(baseline_tick) + ".");
+		snapshot.players = baseline->players;
+		snapshot.bullets = baseline->bullets;
+		for (auto &bullet : snapshot.bullets) {
+			bullet.position = predict_bullet(bullet, snapshot.tick - baseline_tick, snapshot.step);
+		}
+	} else {
+		snapshot.players.clear();
+		snapshot.bullets.clear();
+	}
+
+	//apply removals and changes (ids ascend, so the lists stay sorted):
+	auto read_changes = [&](auto &list, auto const &read_fields) {
+		typedef typename std::remove_reference< decltype(list) >::type::value_type State;
+		auto by_id = [](State const &a, uint32_t id) { return a.id < id; };
+
+		removed_ids.clear();
+		uint32_t removed = read_varint();
+		uint32_t previous = 0;
+		for (uint32_t r = 0; r < removed; ++r) {
+			previous += read_varint();
+			removed_ids.emplace_back(previous);
+		}
+		list.erase(std::remove_if(list.begin(), list.end(), [&](State const &s) {
+			return std::binary_search(removed_ids.begin(), removed_ids.end(), s.id);
+		}), list.end());
+
+		uint32_t changed = read_varint();
+		previous = 0;
+		for (uint32_t c = 0; c < changed; ++c) {
+			previous += read_varint();
+			uint8_t mask;
+			read(&mask);
+			auto f = std::lower_bound(list.begin(), list.end(), previous, by_id);
+			if (f == list.end() || f->id != previous) {
+				f = list.emplace(f);
+				f->id = previous;
+			}
+			read_fields(mask, *f);
+		}
+	};
+
+	read_changes(snapshot.players, [&](uint8_t mask, Snapshot::PlayerState &player) {
+		if (mask & PlayerPosition) read(&player.position);
+		if (mask & PlayerVelocity) read(&player.velocity);
+		if (mask & PlayerColor) read(&player.color);
+		if (mask & PlayerGravity) player.gravity = uint8_t(mask >> PlayerGravityShift);
+		if (mask & PlayerHP) player.HP = unzigzag(read_varint());
+	});
+
+	read_changes(snapshot.bullets, [&](uint8_t mask, Snapshot::BulletState &bullet) {
+		if (mask & BulletPositionRaw) {
+			read(&bullet.position);
+		} else if (mask & BulletPosition) {
+			uint16_t position[2];
+			read(&position);
+			for (int axis = 0; axis < 2; ++axis) {
+				bullet.position[axis] = Snapshot::dequantize_position(position[axis], axis);
+			}
+		}
+		if (mask & BulletVelocityRaw) read(&bullet.velocity);
+		else if (mask & BulletVelocity) bullet.velocity = BulletDirections[(mask >> BulletDirectionShift) & 3];
+		if (mask & BulletColor) read(&bullet.color);
+	});
+
+	if (at != size) throw std::runtime_error("Trailing data in state message.");
+
+	//delete message from buffer:
+	recv_buffer.consume(4 + size);
+
+	//keep the snapshot (as a future baseline) and let the server know it arrived:
+	snapshot_tick = snapshot.tick;
+	std::swap(snapshots[snapshot_tick % SnapshotHistory], snapshot); //(old slot contents become scratch space)
+	send_ack_message(&connection, snapshot_tick, roster_version);
+
+	//set game state from the snapshot (own player first):
+	Snapshot const &state = snapshots[snapshot_tick % SnapshotHistory];
 	players.clear();
-	uint8_t player_count;
-	read(&player_count);
-	for (uint8_t i = 0; i < player_count; ++i) {
-		players.emplace_back();
-		Player &player = players.back();
-		read(&player.position);
-		read(&player.velocity);
-		read(&player.color);
-		read(&player.movement_index);
-		read(&player.gravity);
-		read(&player.HP);
-		uint8_t name_len;
-		read(&name_len);
-		//n.b. would probably be more efficient to directly copy from recv_buffer, but I think this is clearer:
-		player.name = "";
-		for (uint8_t n = 0; n < name_len; ++n) {
-			char c;
-			read(&c);
-			player.name += c;
+	for (auto const &from : state.players) {
+		auto at_ = (from.id == own_id ? players.begin() : players.end());
+		Player &player = *players.emplace(at_);
+		set_player_state(player, from);
+		if (from.id == own_id) {
+			player.position = own_position;
+			player.acceleration = own_acceleration;
+			player.jump_pressing = (own_flags & 1);
+			player.shoot_pressing = (own_flags & 2);
+			player.controls.sequence = own_sequence;
 		}
 	}
+	own_player_id = own_id;
 
 	bullets.clear();
-	uint8_t bullet_count;
-	read(&bullet_count);
-	for (uint8_t i = 0; i < bullet_count; ++i) {
-		bullets.emplace_back();
-		Bullet &bullet = bullets.back();
-		read(&bullet.position);
-		read(&bullet.velocity);
-		read(&bullet.color);
+	for (auto const &from : state.bullets) {
+		bullets.push(from.position, from.velocity, from.color, from.id);
 	}
 
-	if (at != size) throw std::runtime_error("Trailing data in state message.");
+	return true;
+}
+
+void Game::set_player_state(Player &player, Snapshot::PlayerState const &from) const {
+	player.id = from.id;
+	for (int axis = 0; axis < 2; ++axis) {
+		player.position[axis] = Snapshot::dequantize_position(from.position[axis], axis);
+		player.velocity[axis] = dequantize_velocity(from.velocity[axis]);
+	}
+	player.color = from.color;
+	player.movement_index = (from.gravity & 1);
+	player.gravity = (from.gravity & 2 ? Gravity : -Gravity);
+	player.HP = from.HP;
+	auto name = std::lower_bound(roster.begin(), roster.end(), from.id, [](auto const &entry, uint32_t id) { return entry.first < id; });
+	if (name != roster.end() && name->first == from.id) player.name = name->second;
+}
+
+void Game::show_interpolated_state(double tick) {
+	//the snapshots in history on either side of 'tick':
+	Snapshot const *before = nullptr;
+	Snapshot const *after = nullptr;
+	for (auto const &snapshot : snapshots) {
+		if (snapshot.tick == Snapshot::NoTick) continue;
+		if (double(snapshot.tick) <= tick) {
+			if (!before || snapshot.tick > before->tick) before = &snapshot;
+		} else {
+			if (!after || snapshot.tick < after->tick) after = &snapshot;
+		}
+	}
+	if (!before) std::swap(before, after); //('tick' is older than anything in history, so show the oldest)
+	if (!before) return;
+	float since = float(std::max(0.0, tick - double(before->tick))); //(in ticks)
+	float amount = (after ? since / float(after->tick - before->tick) : 0.0f);
+
+	//everyone but the recipient's own player (which stays as of the latest state message) is shown as they were at 'tick':
+	auto keep = players.begin();
+	if (keep != players.end() && own_player_id != 0 && keep->id == own_player_id) ++keep;
+	players.erase(keep, players.end());
+	for (auto const &from : before->players) {
+		if (from.id == own_player_id) continue;
+		Player &player = players.emplace_back();
+		set_player_state(player, from);
+		if (!after) continue;
+		auto to = std::lower_bound(after->players.begin(), after->players.end(), from.id, [](Snapshot::PlayerState const &a, uint32_t id) { return a.id < id; });
+		if (to == after->players.end() || to->id != from.id) continue; //(left before 'after'; shown where last seen)
+		for (int axis = 0; axis < 2; ++axis) {
+			player.position[axis] = glm::mix(player.position[axis], Snapshot::dequantize_position(to->position[axis], axis), amount);
+		}
+	}
+	//(players who joined after 'before' show up once it catches up to them)
+
+	//bullets fly in straight lines, so they can just be moved along from 'before':
+	bullets.clear();
+	for (auto const &from : before->bullets) {
+		glm::vec2 position = from.position;
+		step_bullet(&position, from.velocity, since * before->step);
+		bullets.push(position, from.velocity, from.color, from.id);
+	}
+}
+
+void SnapshotClock::arrived(uint32_t tick, float step_, double now) {
+	step = step_;
+	latest = std::max(latest, tick);
+	double sample = now - double(tick) * step; //(local time tick zero would have arrived, going by this message)
+	if (!started) {
+		started = true;
+		origin = sample;
+		jitter = 0.0;
+		delay = step;
+		return;
+	}
+	//'origin' tracks the earliest arrivals: it moves quickly toward early ones, and only creeps toward late ones (in case the clocks drift):
+	double late = sample - origin;
+	if (late < 0.0) {
+		origin += 0.5 * late;
+		late = 0.0;
+	} else {
+		origin += 0.01 * late;
+	}
+	//...so 'jitter' is how late messages usually are, and the delay covers it with room to spare:
+	jitter += 0.1 * (late - jitter);
+	double target = std::clamp(double(step) + 2.0 * jitter, double(step), MaxDelay);
+	//(delay changes are eased in, so playback speeds up or slows down a little instead of jumping)
+	delay += 0.1 * (target - delay);
+}
+
+double SnapshotClock::render_tick(double now) const {
+	if (!started) return 0.0;
+	return std::min(double(latest), (now - origin - delay) / double(step));
+}
+
+//Roster message: u32 version, varint count, then for each player (ascending id): varint id gap, u8 name length, name bytes
+
+SharedBytes Game::encode_roster_message() const {
+	TRACE_ZONE("Game::encode_roster_message");
+	std::vector< std::pair< uint32_t, std::string const * > > entries;
+	entries.reserve(players.size());
+	for (auto const &player : players) {
+		entries.emplace_back(player.id, &player.name);
+	}
+	std::sort(entries.begin(), entries.end());
+
+	auto message = std::make_shared< std::vector< uint8_t > >();
+	auto send_varint = [&](uint32_t val) {
+		while (val >= 0x80) {
+			message->emplace_back(uint8_t(val | 0x80));
+			val >>= 7;
+		}
+		message->emplace_back(uint8_t(val));
+	};
+
+	message->emplace_back(uint8_t(Message::S2C_Roster));
+	message->resize(4); //(size goes here once known)
+	message->insert(message->end(), reinterpret_cast< uint8_t const * >(&roster_version), reinterpret_cast< uint8_t const * >(&roster_version) + 4);
+	send_varint(uint32_t(entries.size()));
+	uint32_t previous = 0;
+	for (auto const &[id, name] : entries) {
+		send_varint(id - previous);
+		previous = id;
+		//effectively: truncates player name to 255 chars
+		uint8_t len = uint8_t(std::min< size_t >(255, name->size()));
+		message->emplace_back(len);
+		message->insert(message->end(), name->begin(), name->begin() + len);
+	}
+
+	uint32_t size = uint32_t(message->size() - 4);
+	if (size >= (1 << 24)) throw std::runtime_error("Roster message too large.");
+	(*message)[1] = uint8_t(size);
+	(*message)[2] = uint8_t(size >> 8);
+	(*message)[3] = uint8_t(size >> 16);
+
+	return message;
+}
+
+bool Game::recv_roster_message(Connection *connection_) {
+	assert(connection_);
+	auto &connection = *connection_;
+	auto &recv_buffer = connection.recv_buffer;
+
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(Message::S2C_Roster)) return false;
+	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+	              | (uint32_t(recv_buffer[2]) << 8)
+	              |  uint32_t(recv_buffer[1]);
+	uint32_t at = 0;
+	//expecting complete message:
+	if (recv_buffer.size() < 4 + size) return false;
+
+	auto read_byte = [&]() {
+		if (at + 1 > size) throw std::runtime_error("Ran out of bytes reading roster message.");
+		return recv_buffer[4 + at++];
+	};
+	auto read_varint = [&]() {
+		uint32_t val = 0;
+		for (uint32_t shift = 0; ; shift += 7) {
+			uint8_t byte = read_byte();
+			if (shift > 28) throw std::runtime_error("Overlong varint in roster message.");
+			val |= uint32_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) break;
+		}
+		return val;
+	};
+
+	if (at + 4 > size) throw std::runtime_error("Ran out of bytes reading roster message.");
+	std::memcpy(&roster_version, &recv_buffer[4 + at], 4);
+	at += 4;
+	roster.clear();
+	uint32_t count = read_varint();
+	uint32_t id = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		id += read_varint();
+		uint8_t len = read_byte();
+		if (at + len > size) throw std::runtime_error("Ran out of bytes reading roster message.");
+		roster.emplace_back(id, std::string(reinterpret_cast< char const * >(&recv_buffer[4 + at]), len));
+		at += len;
+	}
+
+	if (at != size) throw std::runtime_error("Trailing data in roster message.");
 
 	//delete message from buffer:
-	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	recv_buffer.consume(4 + size);
 
 	return true;
 }
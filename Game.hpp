@@ -1,12 +1,18 @@
 #pragma once
 
+#include "Collision.hpp"
+#include "Connection.hpp"
+
 #include <glm/glm.hpp>
 
 #include <string>
 #include <list>
-#include <random>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cassert>
 
-struct Connection;
+struct WorkerPool;
 
 //Game state, separate from rendering.
 
@@ -14,10 +20,27 @@ struct Connection;
 
 enum class Message : uint8_t {
 	C2S_Controls = 1, //Greg!
+	C2S_Ping = 2,
+	C2S_Ack = 3, //client has applied the state message for a tick, and has a roster version (sent by Game::recv_state_message)
 	S2C_State = 's',
+	S2C_Pong = 'p',
+	S2C_Roster = 'r', //player names (sent whenever they change; state messages refer to players by id only)
 	//...
 };
 
+//latency probe:
+// a client may send a C2S_Ping carrying any 32-bit token; the server sends the latest token
+// back as an S2C_Pong right after its next state message, so the round trip includes waiting for a tick.
+void send_ping_message(Connection *connection, Message type, uint32_t token);
+//returns 'false' if no message or not a 'type' message,
+//returns 'true' if read a ping/pong message (and sets *token),
+//throws on malformed message
+bool recv_ping_message(Connection *connection, Message type, uint32_t *token);
+
+//acknowledgement of the latest state message's tick and roster version the client has (same return/throw behavior as recv_ping_message):
+void send_ack_message(Connection *connection, uint32_t tick, uint32_t roster_version);
+bool recv_ack_message(Connection *connection, uint32_t *tick, uint32_t *roster_version);
+
 //used to represent a control input:
 struct Button {
 	uint8_t downs = 0; //times the button has been pressed
@@ -30,12 +53,43 @@ struct Player {
 	struct Controls {
 		Button left, right, up, down, jump, shoot;
 
-		void send_controls_message(Connection *connection) const;
+		//controls are sampled once per input step, and each step is numbered ('sequence');
+		// a message is only sent when something changed (or every KeepaliveSteps steps anyway), so the receiver
+		// treats every tick it simulates without news as one more step of the same buttons (see simulated_step()).
+		//On unreliable connections, each message also repeats the last few sent before it
+		// (so a lost message doesn't lose button presses, and the receiver skips any it has already applied).
+		inline static constexpr uint32_t Redundancy = 3; //input states in each message (its own, then repeats of the ones before)
+		inline static constexpr uint32_t KeepaliveSteps = 10; //(sender) longest run of steps without a message
+		uint32_t sequence = 0; //(sender) current step -- advance once per step, message or not; (receiver) step of the last message applied
+		struct Sent {
+			uint32_t sequence = 0;
+			uint8_t buttons[6] = {};
+		};
+		Sent sent[Redundancy]; //(sender) the last few messages' steps and buttons, newest first (sequence 0: nothing)
+		uint32_t held_ticks = 0; //(receiver) ticks simulated since the last message was applied (including the one that applied it)
+
+		//(sender) would a message now say anything new? (a button changed, or was pressed since the last message, or a keepalive is due)
+		bool should_send() const;
+		//(receiver) sender's step that the player's state has been simulated through:
+		uint32_t simulated_step() const { return (sequence == 0 || held_ticks == 0 ? sequence : sequence + held_ticks - 1); }
+
+		//send the buttons as step 'sequence' (along with the last few sent, on unreliable connections):
+		void send_controls_message(Connection *connection);
 
 		//returns 'false' if no message or not a controls message,
-		//returns 'true' if read a controls message,
+		//returns 'true' if read a controls message (applying any steps in it that are newer than 'sequence', oldest first),
 		//throws on malformed controls message
 		bool recv_controls_message(Connection *connection);
+
+		//the same in two parts, so a message can be read on one thread and applied on another:
+		struct Received {
+			uint32_t count = 0;
+			Sent steps[Redundancy]; //newest first
+		};
+		//read a controls message into 'received' (same return/throw behavior as above):
+		static bool recv_controls_message(Connection *connection, Received *received);
+		//apply the steps in 'received' that are newer than 'sequence', oldest first:
+		void apply(Received const &received);
 	} controls;
 
 	bool jump_pressing = false;
@@ -50,8 +104,10 @@ struct Player {
 	float gravity = -9.8f;
 	int HP = 100;
 
-	glm::vec3 color = glm::vec3(1.0f, 1.0f, 1.0f);
+	uint8_t color = 0; //index into Game::palette() (unique among current players; never Game::UnownedColor)
 	std::string name = "";
+
+	uint32_t id = 0; //unique within a game (assigned by spawn_player; 0 is never used)
 };
 
 struct Platform {
@@ -59,10 +115,168 @@ struct Platform {
 	glm::vec2 positionMax = glm::vec2(0.0f, 0.0f);
 };
 
-struct Bullet {
-	glm::vec2 position = glm::vec2(0.0f, 0.0f);
-	glm::vec2 velocity = glm::vec2(0.0f, 0.0f);
-	glm::vec3 color = glm::vec3(1.0f, 1.0f, 1.0f);
+//all live bullets, stored as parallel arrays (bullet 'i' is positions[i], velocities[i], colors[i], ids[i]):
+// - spawning appends to each array; once the arrays have grown to a match's peak bullet count, no further allocation happens.
+// - removal swaps the last bullet into the hole, so bullet order is *not* stable.
+struct BulletPool {
+	std::vector< glm::vec2 > positions;
+	std::vector< glm::vec2 > velocities;
+	std::vector< uint8_t > colors; //palette color of the player that fired the bullet (bullets don't hit their owner)
+	std::vector< uint32_t > ids; //unique within a game, increasing in firing order (see Game::next_bullet_id)
+
+	size_t size() const { return positions.size(); }
+	bool empty() const { return positions.empty(); }
+
+	//add a bullet to the end of the pool:
+	void push(glm::vec2 const &position, glm::vec2 const &velocity, uint8_t color, uint32_t id) {
+		positions.emplace_back(position);
+		velocities.emplace_back(velocity);
+		colors.emplace_back(color);
+		ids.emplace_back(id);
+	}
+
+	//remove bullet 'i' by moving the last bullet into its slot:
+	void remove(size_t i) {
+		assert(i < size());
+		size_t last = size() - 1;
+		if (i != last) {
+			positions[i] = positions[last];
+			velocities[i] = velocities[last];
+			colors[i] = colors[last];
+			ids[i] = ids[last];
+		}
+		positions.pop_back();
+		velocities.pop_back();
+		colors.pop_back();
+		ids.pop_back();
+	}
+
+	//remove all bullets (keeps allocated storage):
+	void clear() {
+		positions.clear();
+		velocities.clear();
+		colors.clear();
+		ids.clear();
+	}
+
+	void reserve(size_t count) {
+		positions.reserve(count);
+		velocities.reserve(count);
+		colors.reserve(count);
+		ids.reserve(count);
+	}
+};
+
+//uniform grid of square cells over a rectangle, each cell holding a list of item indices:
+// - items are bucketed with a counting sort (so re-building re-uses storage).
+// - indices within a cell are in ascending item order.
+// - points outside the rectangle are clamped to the edge cells.
+struct UniformGrid {
+	UniformGrid(glm::vec2 const &min, glm::vec2 const &max, float cell_size);
+
+	float cell_size;
+	glm::vec2 origin;
+	glm::ivec2 size; //cell count in x and y
+	std::vector< uint32_t > cell_start; //cell 'c' holds entries [cell_start[c], cell_start[c+1]) (size.x * size.y + 1 entries)
+	std::vector< uint32_t > entries; //item indices, grouped by cell
+
+	//clamped coordinate of the cell containing a point:
+	glm::ivec2 cell(glm::vec2 const &at) const;
+	uint32_t cell_index(glm::ivec2 const &c) const { return uint32_t(c.y * size.x + c.x); }
+
+	//(re-)fill the grid with 'count' items; item_cells(i, &lo, &hi) gives the (inclusive) range of cells item 'i' covers:
+	template< typename ItemCells >
+	void build(uint32_t count, ItemCells const &item_cells);
+};
+
+template< typename ItemCells >
+void UniformGrid::build(uint32_t count, ItemCells const &item_cells) {
+	std::fill(cell_start.begin(), cell_start.end(), 0);
+	for (uint32_t i = 0; i < count; ++i) {
+		glm::ivec2 lo, hi;
+		item_cells(i, &lo, &hi);
+		for (int y = lo.y; y <= hi.y; ++y) {
+			for (int x = lo.x; x <= hi.x; ++x) {
+				cell_start[cell_index(glm::ivec2(x, y)) + 1] += 1;
+			}
+		}
+	}
+	for (size_t c = 1; c < cell_start.size(); ++c) {
+		cell_start[c] += cell_start[c-1];
+	}
+	entries.resize(cell_start.back());
+	//(uses cell_start[c] as a write cursor, which shifts it to the start of cell c+1; shifted back below)
+	for (uint32_t i = 0; i < count; ++i) {
+		glm::ivec2 lo, hi;
+		item_cells(i, &lo, &hi);
+		for (int y = lo.y; y <= hi.y; ++y) {
+			for (int x = lo.x; x <= hi.x; ++x) {
+				entries[cell_start[cell_index(glm::ivec2(x, y))]++] = i;
+			}
+		}
+	}
+	for (size_t c = cell_start.size() - 1; c > 0; --c) {
+		cell_start[c] = cell_start[c-1];
+	}
+	cell_start[0] = 0;
+}
+
+//Small, fast pseudo-random number generator (PCG32 -- see https://www.pcg-random.org/ ).
+// All of the simulation's random decisions come from Game::rng, so a match
+// started from the same seed and fed the same controls plays out identically.
+struct Random {
+	uint64_t state = 0;
+	uint64_t increment = 1; //(must be odd)
+
+	explicit Random(uint64_t seed, uint64_t stream = 0x15466);
+
+	//uniform 32-bit value:
+	uint32_t operator()() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ull + increment;
+		uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = uint32_t(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+	}
+	static constexpr uint32_t max() { return 0xffffffffu; }
+};
+
+//Copy of the state sent to clients for one tick, with players and bullets sorted by id.
+// The server and each client keep the last few of these (Game::snapshots) so that a state message
+// can be sent as just the changes from a snapshot the client has acknowledged.
+//Snapshots hold the state as it goes over the wire -- already quantized -- so the server's and client's copies match exactly.
+// Precision (compared to the server's Game):
+//  - positions are 16-bit fixed point over the arena (plus PositionMargin), so steps are 5.3e-5 (x) and 3.8e-5 (y);
+//    player positions are rounded to the nearest step, bullet positions are kept within one step (see Game::record_snapshot);
+//  - player velocities are 8.8 fixed point (within 1/512);
+//  - bullet velocities, gravity (always +/- Game::Gravity), movement axis, HP, and palette colors are exact.
+struct Snapshot {
+	inline static constexpr uint32_t NoTick = 0; //(ticks are numbered from 1)
+	uint32_t tick = NoTick;
+	float step = 0.0f; //seconds simulated per tick (bullets missing from a delta are moved this far per tick)
+
+	struct PlayerState {
+		uint32_t id;
+		uint16_t position[2]; //see quantize_position
+		int16_t velocity[2]; //8.8 fixed point
+		uint8_t color;
+		uint8_t gravity; //bit 0: movement_index, bit 1: gravity > 0
+		int HP;
+	};
+	std::vector< PlayerState > players;
+
+	struct BulletState {
+		uint32_t id;
+		glm::vec2 position; //as the client has it: dequantized when sent, then moved along with Game::step_bullet
+		glm::vec2 velocity;
+		uint8_t color;
+	};
+	std::vector< BulletState > bullets;
+
+	//fixed-point positions ('axis' is 0 for x, 1 for y):
+	inline static constexpr float PositionMargin = 0.25f; //(bullets can stray a bit past the arena before they are removed)
+	static uint16_t quantize_position(float position, int axis);
+	static float dequantize_position(uint16_t position, int axis);
 };
 
 struct Game {
@@ -70,17 +284,41 @@ struct Game {
 	Player *spawn_player(); //add player the end of the players list (may also, e.g., play some spawn anim)
 	void remove_player(Player *); //remove player from game (may also, e.g., play some despawn anim)
 
-	std::mt19937 mt; //used for spawning players
-	uint32_t next_player_number = 1; //used for naming players
+	Random rng; //source of all randomness in the simulation (spawning, gravity changes)
+	uint32_t next_player_number = 1; //used for naming players (and as player ids)
+	uint32_t next_bullet_id = 1;
 
 	float timer = 0.0f;
 	float interval = 5.0f;
 
-	Game();
+	inline static constexpr uint64_t DefaultSeed = 0x15466666;
+	Game(uint64_t seed = DefaultSeed);
 
 	//state update function:
 	void update(float elapsed);
 
+	//if set, update() spreads its per-player and per-bullet phases across these threads:
+	// (results are identical for any thread count)
+	WorkerPool *workers = nullptr;
+
+	//pieces of update():
+	//jump, gravity, and movement along the player's axes (with platform stops):
+	void move_player(Player &player, float elapsed, std::vector< uint32_t > *scratch) const;
+	//bullet direction, sliding off platforms, and staying inside the arena:
+	void constrain_player(Player &player, float elapsed, std::vector< uint32_t > *scratch) const;
+	//move bullet 'i' and test it against the level and players (needs player_grid);
+	// returns the (grid_players) index of the player hit, or one of:
+	inline static constexpr uint32_t BulletFlying = uint32_t(-1); //still in flight
+	inline static constexpr uint32_t BulletGone = uint32_t(-2); //left the arena or hit a platform
+	uint32_t advance_bullet(uint32_t i, float elapsed, std::vector< uint32_t > *scratch);
+	//a bullet's flight over one tick (also used to predict bullet positions in delta-encoded state):
+	static void step_bullet(glm::vec2 *position, glm::vec2 const &velocity, float elapsed) {
+		position->x += elapsed * velocity.x;
+		position->y += elapsed * velocity.y;
+	}
+	//call fn(chunk, begin, end) for contiguous ranges covering [0, count), one per worker:
+	void for_each_chunk(uint32_t count, std::function< void(uint32_t chunk, uint32_t begin, uint32_t end) > const &fn);
+
 	//constants:
 	//the update rate on the server:
 	inline static constexpr float Tick = 1.0f / 30.0f;
@@ -93,27 +331,131 @@ struct Game {
 	inline static constexpr float PlayerRadius = 0.04f;
 	inline static constexpr float PlayerSpeed = 5.0f;
 	inline static constexpr float PlayerAccelHalflife = 0.05f;
+	//longest gravity-axis move tested for platform collisions at once
+	// (platforms are at least 0.1 thick and players 0.08 across, so a move under 0.18 can't skip over one):
+	inline static constexpr float PlayerMaxStep = 0.16f;
+	//strength of gravity (players' gravity is always +/- this):
+	inline static constexpr float Gravity = 9.8f;
 
 	inline static constexpr float BulletRadius = 0.02f;
+	inline static constexpr float BulletSpeed = 2.0f; //(bullets fly along an axis, in the shooter's bullet_direction)
+
+	//player colors (see Player::color):
+	inline static constexpr uint32_t PaletteSize = 256;
+	//the last color is kept for bullets no player owns (which can hit anyone), leaving one color each for this many players:
+	inline static constexpr uint8_t UnownedColor = uint8_t(PaletteSize - 1);
+	inline static constexpr uint32_t MaxPlayers = PaletteSize - 1;
+	static glm::vec3 const &palette(uint8_t color);
 
-	//platforms:
-	std::list< Platform > platforms;
+	//platforms (static once the level is built):
+	std::vector< Platform > platforms;
+	UniformGrid platform_grid; //built once in Game::Game()
+
+	//(re-)build platform_grid; call after changing 'platforms':
+	void index_platforms();
+
+	//platform bounds copied into BoxBatch-aligned runs, one run per platform_grid cell:
+	BoxesSoA platform_boxes;
+	std::vector< uint32_t > platform_box_ids; //platform index of each box (or -1 for padding)
+	std::vector< uint32_t > platform_box_start; //cell 'c' has boxes [platform_box_start[c], platform_box_start[c+1])
+
+	//indices (in ascending order) of platforms that overlap 'box' (by the same rule as check_collision):
+	// (results are written to 'out', which is cleared first)
+	void find_overlapping_platforms(QueryBox const &box, std::vector< uint32_t > *out) const;
 
 	//bullets:
-	std::list < Bullet > bullets;
+	BulletPool bullets;
+
+	//bullet/player broadphase, rebuilt every update() after players move:
+	UniformGrid player_grid;
+	std::vector< Player * > grid_players; //players in list order (player_grid entries index this)
+
+	//per-chunk scratch storage for find_overlapping_platforms() results in update():
+	std::vector< std::vector< uint32_t > > chunk_scratch;
+	//per-bullet result of advance_bullet() in update():
+	std::vector< uint32_t > bullet_fates;
 
 	bool check_collision(float leftA, float leftB, float rightA, float rightB, float topA, float topB, float bottomA, float bottomB);
 	
 
 	//---- communication helpers ----
 
+	//state messages are [header][body]:
+	// - the header says which player is the recipient's own, and gives the parts of that player's state that
+	//   client-side prediction needs at full precision (see PlayMode), along with the controls step it has been simulated through;
+	// - the body is a snapshot, encoded as changes from an older snapshot the recipient has acknowledged (its "baseline"),
+	//   or in full if there is no usable baseline. Every recipient with the same baseline can share one body.
+
+	//snapshots of recently sent (server) or received (client) state:
+	inline static constexpr uint32_t SnapshotHistory = 32; //(so acks can lag up to this many ticks before falling back to full state)
+	std::vector< Snapshot > snapshots = std::vector< Snapshot >(SnapshotHistory); //snapshot for tick 't' lives in snapshots[t % SnapshotHistory]
+	uint32_t snapshot_tick = Snapshot::NoTick; //latest snapshot
+	//snapshot for 'tick', if it is still in history (else nullptr):
+	Snapshot const *find_snapshot(uint32_t tick) const;
+
 	//used by client:
-	//set game state from data in connection buffer
+	//set game state from data in connection buffer and acknowledge its tick (by sending a C2S_Ack)
+	//  Moves the recipient's own player to the front of 'players' (with exact position, acceleration, button
+	//  edge state, and -- in controls.sequence -- the controls step the server had simulated it through).
+	//  If several state messages are waiting (e.g., after a hitch), the older ones are skipped without being decoded.
 	// (return true if data was read)
 	bool recv_state_message(Connection *connection);
+	uint32_t own_player_id = 0; //(client) id of the recipient's own player, from the latest state message (0 if none)
+
+	//used by client:
+	//set 'players' (except the recipient's own, which stays as of the latest state message) and 'bullets' to how they were
+	// at a (fractional) 'tick', interpolating between the snapshots in history on either side of it:
+	// (see SnapshotClock for picking 'tick')
+	void show_interpolated_state(double tick);
+	//set the snapshot-carried parts of 'player' (and its name, from 'roster'):
+	void set_player_state(Player &player, Snapshot::PlayerState const &from) const;
+
+	//used by server:
+	//copy the current state into history as the next tick ('step' is the time simulated since the last one); returns the new tick:
+	uint32_t record_snapshot(float step);
+	//encode the body of a state message for snapshot 'tick', relative to snapshot 'baseline' (NoTick or not in history: send everything):
+	SharedBytes encode_state_body(uint32_t tick, uint32_t baseline = Snapshot::NoTick) const;
+	//send a state message around a shared body, telling the recipient that 'connection_player' is theirs (nullptr if none):
+	// (replaces any earlier state message that hasn't started going out yet -- see Connection::send_latest)
+	static void send_state_message(Connection *connection, SharedBytes const &body, Player const *connection_player);
+	inline static constexpr uint32_t OwnHeaderSize = 4 + 4 + 8 + 4 + 1; //(header size when the recipient has a player)
+	inline static constexpr uint32_t StateHeadSize = 4 + OwnHeaderSize; //(most bytes that go before the body)
+	//write the per-recipient bytes that go before 'body' in send_state_message into 'head'; returns how many:
+	// (so the message can be put together somewhere the Player isn't)
+	static uint32_t encode_state_head(SharedBytes const &body, Player const *connection_player, uint8_t head[StateHeadSize]);
+
+	//player names aren't in snapshots; they go in roster messages, which list every player's id and name:
+	// (roster messages can be lost on unreliable connections, so the client acks the version it has along with each state tick)
+	uint32_t roster_version = 0; //(server) bumped whenever players join or leave, (client) version of 'roster'
+	std::vector< std::pair< uint32_t, std::string > > roster; //(client) latest roster received, sorted by id
 
 	//used by server:
-	//send game state.
-	//  Will move "connection_player" to the front of the front of the sent list.
-	void send_state_message(Connection *connection, Player *connection_player = nullptr) const;
+	//encode a whole roster message (the same for every recipient, so it can be shared):
+	SharedBytes encode_roster_message() const;
+
+	//used by client:
+	//set 'roster' from data in connection buffer (return true if data was read)
+	bool recv_roster_message(Connection *connection);
+
+	//scratch space for decoding:
+	Snapshot decoded;
+	std::vector< uint32_t > removed_ids;
+};
+
+//Client-side playback timing for remote entities:
+// state messages arrive with some jitter, so remote players and bullets are shown a little in the past
+// (see Game::show_interpolated_state), by a delay that adapts to how late messages have been arriving lately.
+struct SnapshotClock {
+	//snapshot 'tick' (of a game simulating 'step' seconds per tick) arrived at local time 'now' (in seconds):
+	void arrived(uint32_t tick, float step, double now);
+	//(fractional) tick to show at local time 'now':
+	double render_tick(double now) const;
+
+	bool started = false; //(has anything arrived?)
+	float step = 0.0f;
+	uint32_t latest = Snapshot::NoTick; //newest tick that has arrived
+	double origin = 0.0; //estimated local time at which tick zero would have arrived (were it as quick as the quickest messages)
+	double jitter = 0.0; //how late (seconds, after 'origin' + tick time) messages have been arriving, smoothed
+	double delay = 0.0; //seconds the shown state trails 'origin' + tick time
+	inline static constexpr double MaxDelay = 0.25; //(past this, remote entities lag too much to be worth smoothing)
 };
@@ -1,4 +1,5 @@
 #include "Load.hpp"
+#include "Trace.hpp"
 
 #include <array>
 #include <list>
@@ -21,10 +22,12 @@ void call_load_functions() {
 	static bool has_been_called = false;
 	assert(!has_been_called && "call_load_functions should only be called *once*");
 	has_been_called = true;
+	TRACE_ZONE("call_load_functions");
 
 	auto &load_lists = get_load_lists();
 	for (auto &fn_list : load_lists) {
 		while (!fn_list.empty()) {
+			TRACE_ZONE("load function");
 			(*fn_list.begin())(); //call first function in the list
 			fn_list.pop_front(); //remove from list
 		}
@@ -146,11 +146,21 @@ const client_names = [
 ];
 
 const server_names = [
-	maek.CPP('server.cpp')
+	maek.CPP('server.cpp'),
+	maek.CPP('TickScheduler.cpp')
 ];
 
-const common_names = [
+//game simulation + networking (no SDL / GL needed):
+const game_names = [
 	maek.CPP('Game.cpp'),
+	maek.CPP('Collision.cpp'),
+	maek.CPP('WorkerPool.cpp'),
+	maek.CPP('Connection.cpp'),
+	maek.CPP('Trace.cpp')
+];
+
+const common_names = [
+	...game_names,
 	maek.CPP('data_path.cpp'),
 	maek.CPP('PathFont.cpp'),
 	maek.CPP('PathFont-font.cpp'),
@@ -163,7 +173,6 @@ const common_names = [
 	maek.CPP('Mode.cpp'),
 	maek.CPP('GL.cpp'),
 	maek.CPP('Load.cpp'),
-	maek.CPP('Connection.cpp'),
 	maek.CPP('hex_dump.cpp')
 ];
 
@@ -188,6 +197,12 @@ const server_exe = maek.LINK([...server_names, ...common_names], 'dist/server');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
 
+//benchmarks and load tools (not built by default; ask for them by name, e.g. 'node Maekfile.js dist/collision-bench'):
+const collision_bench_exe = maek.LINK([maek.CPP('collision-bench.cpp'), ...game_names], 'dist/collision-bench');
+const sim_bench_exe = maek.LINK([maek.CPP('sim-bench.cpp'), ...game_names], 'dist/sim-bench');
+const swarm_exe = maek.LINK([maek.CPP('swarm.cpp'), ...game_names], 'dist/swarm');
+const net_bench_exe = maek.LINK([maek.CPP('net-bench.cpp'), ...game_names], 'dist/net-bench');
+
 //set the default target to the game (and copy the readme files):
 maek.TARGETS = [client_exe, server_exe, show_meshes_exe, show_scene_exe, ...copies];
 
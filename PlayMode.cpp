@@ -23,21 +23,27 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 		if (evt.key.repeat) {
 			//ignore repeats
 		} else if (evt.key.keysym.sym == SDLK_a) {
+			controls.left.downs += 1;
 			controls.left.pressed = true;
 			return true;
 		} else if (evt.key.keysym.sym == SDLK_d) {
+			controls.right.downs += 1;
 			controls.right.pressed = true;
 			return true;
 		} else if (evt.key.keysym.sym == SDLK_w) {
+			controls.up.downs += 1;
 			controls.up.pressed = true;
 			return true;
 		} else if (evt.key.keysym.sym == SDLK_s) {
+			controls.down.downs += 1;
 			controls.down.pressed = true;
 			return true;
 		} else if (evt.key.keysym.sym == SDLK_SPACE) {
+			controls.jump.downs += 1;
 			controls.jump.pressed = true;
 			return true;
 		} else if (evt.key.keysym.sym == SDLK_l) {
+			controls.shoot.downs += 1;
 			controls.shoot.pressed = true;
 			return true;
 		}
@@ -66,19 +72,43 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 	return false;
 }
 
+void PlayMode::predict(Player::Controls const &with) {
+	predicted.controls.left = with.left;
+	predicted.controls.right = with.right;
+	predicted.controls.up = with.up;
+	predicted.controls.down = with.down;
+	predicted.controls.jump = with.jump;
+	predicted.controls.shoot = with.shoot;
+	//(same per-player code as Game::update, minus gravity changes, which only the server decides)
+	game.move_player(predicted, step, &scratch);
+	game.constrain_player(predicted, step, &scratch);
+}
+
 void PlayMode::update(float elapsed) {
+	time += elapsed;
+
+	//sample controls once per simulation step, queue them for sending to server if they changed, and predict their effect:
+	step_accumulator = std::min(step_accumulator + elapsed, 8.0f * step); //(after a long stall, don't try to catch up)
+	while (step_accumulator >= step) {
+		step_accumulator -= step;
 
-	//queue data for sending to server:
-	controls.send_controls_message(&client.connection);
+		controls.sequence += 1;
+		if (controls.should_send()) controls.send_controls_message(&client.connection);
+		unapplied.emplace_back(controls);
+		if (unapplied.size() > MaxUnapplied) unapplied.pop_front(); //(server isn't keeping up; prediction this far ahead is hopeless anyway)
+		if (predicting) predict(controls);
 
-	//reset button press counters:
-	controls.left.downs = 0;
-	controls.right.downs = 0;
-	controls.up.downs = 0;
-	controls.down.downs = 0;
-	controls.jump.downs = 0;
+		//reset button press counters:
+		controls.left.downs = 0;
+		controls.right.downs = 0;
+		controls.up.downs = 0;
+		controls.down.downs = 0;
+		controls.jump.downs = 0;
+		controls.shoot.downs = 0;
+	}
 
 	//send/receive data:
+	uint32_t tick_before = game.snapshot_tick;
 	client.poll([this](Connection *c, Connection::Event event){
 		if (event == Connection::OnOpen) {
 			std::cout << "[" << c->socket << "] opened" << std::endl;
@@ -86,12 +116,13 @@ void PlayMode::update(float elapsed) {
 			std::cout << "[" << c->socket << "] closed (!)" << std::endl;
 			throw std::runtime_error("Lost connection to server!");
 		} else { assert(event == Connection::OnRecv);
-			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
+			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer.data(), c->recv_buffer.size()); std::cout.flush(); //DEBUG
 			bool handled_message;
 			try {
 				do {
 					handled_message = false;
 					if (game.recv_state_message(c)) handled_message = true;
+					else if (game.recv_roster_message(c)) handled_message = true;
 				} while (handled_message);
 			} catch (std::exception const &e) {
 				std::cerr << "[" << c->socket << "] malformed message from server: " << e.what() << std::endl;
@@ -100,6 +131,32 @@ void PlayMode::update(float elapsed) {
 			}
 		}
 	}, 0.0);
+
+	//reconcile with new state from the server:
+	if (game.snapshot_tick != tick_before) {
+		step = game.find_snapshot(game.snapshot_tick)->step;
+		clock.arrived(game.snapshot_tick, step, time);
+		predicting = (game.own_player_id != 0 && !game.players.empty() && game.players.front().id == game.own_player_id);
+		if (predicting) {
+			predicted = game.players.front();
+			while (!unapplied.empty() && unapplied.front().sequence <= predicted.controls.sequence) {
+				unapplied.pop_front();
+			}
+			for (auto const &with : unapplied) {
+				predict(with);
+			}
+		}
+	}
+
+	//show other players and bullets as they were a moment ago (smoothing over uneven arrivals):
+	if (clock.started) game.show_interpolated_state(clock.render_tick(time));
+
+	//show own player where it is predicted to be:
+	if (predicting) {
+		Player &own = game.players.front();
+		own.position = predicted.position;
+		own.bullet_direction = predicted.bullet_direction;
+	}
 }
 
 void PlayMode::draw(glm::uvec2 const &drawable_size) {
@@ -171,7 +228,8 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 				} 
 			}
 
-			glm::u8vec4 col = glm::u8vec4(player.color.x*255, player.color.y*255, player.color.z*255, 0xff);
+			glm::vec3 const &color = Game::palette(player.color);
+			glm::u8vec4 col = glm::u8vec4(color.x*255, color.y*255, color.z*255, 0xff);
 			if (&player == &game.players.front()) {
 				//mark current player (which server sends first):
 				lines.draw(
@@ -204,12 +262,14 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 			lines.draw(glm::vec3(p.positionMax.x, p.positionMin.y, 0.0f), glm::vec3(p.positionMax.x, p.positionMax.y, 0.0f), col);
 		}
 
-		for (auto const &b : game.bullets) {
-			glm::u8vec4 col = glm::u8vec4(b.color.x*255, b.color.y*255, b.color.z*255, 0xff);
+		for (size_t i = 0; i < game.bullets.size(); ++i) {
+			glm::vec2 const &position = game.bullets.positions[i];
+			glm::vec3 const &color = Game::palette(game.bullets.colors[i]);
+			glm::u8vec4 col = glm::u8vec4(color.x*255, color.y*255, color.z*255, 0xff);
 			for (uint32_t a = 0; a < circle.size(); ++a) {
 				lines.draw(
-					glm::vec3(b.position + Game::BulletRadius * circle[a], 0.0f),
-					glm::vec3(b.position + Game::BulletRadius * circle[(a+1)%circle.size()], 0.0f),
+					glm::vec3(position + Game::BulletRadius * circle[a], 0.0f),
+					glm::vec3(position + Game::BulletRadius * circle[(a+1)%circle.size()], 0.0f),
 					col
 				);
 			}
@@ -25,6 +25,25 @@ struct PlayMode : Mode {
 	//latest game state (from server):
 	Game game;
 
+	//client-side prediction of own player:
+	// controls are sampled once per simulation step (and sent if they changed), and applied to 'predicted' right away;
+	// when a state message arrives, 'predicted' restarts from the server's copy of the player and
+	// replays the controls the server hadn't applied yet.
+	Player predicted;
+	bool predicting = false; //is 'predicted' valid? (need a state message with an own player first)
+	std::deque< Player::Controls > unapplied; //controls sent but not yet applied by the server, oldest first
+	inline static constexpr size_t MaxUnapplied = 64;
+	float step = Game::Tick; //seconds per simulation step (from the latest state message)
+	float step_accumulator = 0.0f; //time since controls were last sampled
+	std::vector< uint32_t > scratch; //for Game::move_player/constrain_player
+
+	//advance 'predicted' by one step with the given controls:
+	void predict(Player::Controls const &with);
+
+	//everything else is shown a little in the past, interpolated between snapshots:
+	SnapshotClock clock;
+	double time = 0.0; //seconds of local time (the sum of update()'s 'elapsed')
+
 	//last message from server:
 	std::string server_message;
 
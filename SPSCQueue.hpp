@@ -0,0 +1,82 @@
+#pragma once
+
+/*
+ * SPSCQueue hands items from one thread (the producer) to one other thread (the consumer) without locks:
+ *
+ *   SPSCQueue< Item > queue;
+ *   //producer thread:
+ *   queue.push(std::move(item));
+ *   //consumer thread:
+ *   Item item;
+ *   while (queue.pop(&item)) {
+ *       //...handle item...
+ *   }
+ *
+ * Items are stored in fixed-size blocks. The producer links on a new block when the current one is full,
+ * and the consumer frees each block once it has taken everything in it. So push() never waits or fails,
+ * and items are only ever written by one thread and read by the other.
+ *
+ * Only the producer may push() and only the consumer may pop(). Either role may move to a different thread
+ * between calls, as long as something else (e.g., WorkerPool::run) orders the hand-off.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+template< typename T, size_t BlockSize = 256 >
+struct SPSCQueue {
+	SPSCQueue() : head_block(new Block), tail_block(head_block) { }
+	~SPSCQueue() {
+		while (head_block) {
+			Block *next = head_block->next.load(std::memory_order_relaxed);
+			delete head_block;
+			head_block = next;
+		}
+	}
+
+	SPSCQueue(SPSCQueue const &) = delete;
+	SPSCQueue &operator=(SPSCQueue const &) = delete;
+
+	//(producer) add 'item' at the back:
+	void push(T &&item) {
+		if (tail_index == BlockSize) {
+			Block *block = new Block;
+			tail_block->next.store(block, std::memory_order_release);
+			tail_block = block;
+			tail_index = 0;
+		}
+		tail_block->items[tail_index] = std::move(item);
+		tail_index += 1;
+		tail_block->written.store(tail_index, std::memory_order_release);
+	}
+
+	//(consumer) take the item at the front (returns false if there isn't one yet):
+	bool pop(T *item) {
+		if (head_index == BlockSize) {
+			//(the producer has moved on to the next block once it is linked, so this one can go)
+			Block *next = head_block->next.load(std::memory_order_acquire);
+			if (!next) return false;
+			delete head_block;
+			head_block = next;
+			head_index = 0;
+		}
+		if (head_index == head_block->written.load(std::memory_order_acquire)) return false;
+		*item = std::move(head_block->items[head_index]);
+		head_index += 1;
+		return true;
+	}
+
+	//internals:
+	struct Block {
+		T items[BlockSize];
+		std::atomic< size_t > written{0}; //items[0, written) have been pushed
+		std::atomic< Block * > next{nullptr}; //(set once this block is full)
+	};
+	//consumer's end:
+	alignas(64) Block *head_block;
+	size_t head_index = 0;
+	//producer's end:
+	alignas(64) Block *tail_block;
+	size_t tail_index = 0;
+};
@@ -1,6 +1,7 @@
 #include "Sound.hpp"
 #include "load_wav.hpp"
 #include "load_opus.hpp"
+#include "Trace.hpp"
 
 #include <SDL.h>
 
@@ -313,6 +314,12 @@ void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp) {
 //The audio callback -- invoked by SDL when it needs more sound to play:
 void mix_audio(void *, Uint8 *buffer_, int len) {
 	assert(buffer_); //should always have some audio buffer
+	static bool named = false; //(only ever called on SDL's audio thread)
+	if (!named) {
+		Trace::set_thread_name("audio");
+		named = true;
+	}
+	TRACE_ZONE("mix_audio");
 
 	struct LR {
 		float l;
@@ -0,0 +1,106 @@
+#include "TickScheduler.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+
+#ifdef __linux__
+#include <time.h>
+#include <errno.h>
+#endif
+
+TickScheduler::TickScheduler(double period_, Overrun overrun_, uint32_t max_catch_up_)
+	: period(std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(period_))),
+	  overrun(overrun_), max_catch_up(max_catch_up_) {
+	if (period <= Clock::duration::zero()) period = Clock::duration(1);
+	report_start = Clock::now();
+	deadline = report_start + period;
+}
+
+//sleep until 't' (absolute, so time spent getting here doesn't count):
+static void sleep_until(TickScheduler::Clock::time_point t) {
+	#ifdef __linux__
+	//(steady_clock is CLOCK_MONOTONIC here)
+	auto since_epoch = std::chrono::duration_cast< std::chrono::nanoseconds >(t.time_since_epoch()).count();
+	struct timespec ts;
+	ts.tv_sec = time_t(since_epoch / 1000000000);
+	ts.tv_nsec = long(since_epoch % 1000000000);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) { }
+	#else
+	std::this_thread::sleep_until(t);
+	#endif
+}
+
+uint32_t TickScheduler::wait() {
+	Clock::time_point now = Clock::now();
+	if (now > deadline) {
+		overruns += 1; //(the last tick -- or its catch-up ticks -- ran past this deadline)
+	} else {
+		sleep_until(deadline);
+		now = Clock::now();
+	}
+
+	//how late is this wakeup?
+	Clock::duration late = std::max(now - deadline, Clock::duration::zero());
+	max_lateness = std::max(max_lateness, late);
+	uint64_t us = uint64_t(std::chrono::duration_cast< std::chrono::microseconds >(late).count());
+	uint32_t bucket = 0;
+	while (us > 0 && bucket + 1 < LatenessBuckets) {
+		us >>= 1;
+		bucket += 1;
+	}
+	lateness[bucket] += 1;
+
+	//deadlines that have also passed since:
+	uint64_t missed = uint64_t(late / period);
+	uint32_t run = 1;
+	if (overrun == Overrun::CatchUp) {
+		uint32_t extra = uint32_t(std::min< uint64_t >(missed, max_catch_up));
+		run += extra;
+		caught_up += extra;
+		dropped += missed - extra;
+	} else { //Overrun::Drop
+		dropped += missed;
+	}
+	deadline += period * (missed + 1);
+	ticks += run;
+	return run;
+}
+
+std::string TickScheduler::report() {
+	auto to_us = [](Clock::duration d) {
+		return std::chrono::duration< double, std::micro >(d).count();
+	};
+	Clock::time_point now = Clock::now();
+
+	uint64_t wakeups = 0;
+	for (auto count : lateness) wakeups += count;
+	//(upper bound of the bucket the q-th wakeup falls in)
+	auto percentile = [&](double q) -> std::string {
+		uint64_t rank = uint64_t(q * double(wakeups));
+		uint64_t seen = 0;
+		for (uint32_t i = 0; i < LatenessBuckets; ++i) {
+			seen += lateness[i];
+			if (seen > rank) return (i + 1 < LatenessBuckets ? "<" + std::to_string(uint64_t(1) << i) + "us" : "long");
+		}
+		return "n/a";
+	};
+
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1);
+	out << "Ticks over the last " << std::chrono::duration< double >(now - report_start).count() << "s: "
+	    << ticks << " run (" << caught_up << " to catch up), " << dropped << " dropped, " << overruns << " overrun(s); "
+	    << "wakeup lateness p50 " << percentile(0.50) << ", p99 " << percentile(0.99) << ", max " << to_us(max_lateness) << "us; "
+	    << "per tick: poll " << to_us(phase_time[Poll]) / std::max< uint64_t >(ticks, 1) << "us"
+	    << ", update " << to_us(phase_time[Update]) / std::max< uint64_t >(ticks, 1) << "us"
+	    << ", serialize " << to_us(phase_time[Serialize]) / std::max< uint64_t >(ticks, 1) << "us.";
+
+	ticks = overruns = caught_up = dropped = 0;
+	lateness.fill(0);
+	max_lateness = Clock::duration::zero();
+	phase_time.fill(Clock::duration::zero());
+	report_start = now;
+
+	return out.str();
+}
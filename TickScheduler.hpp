@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+ * TickScheduler runs a fixed-rate loop against absolute deadlines (start + n * period), so sleeping late or a slow
+ * tick never pushes later ticks back:
+ *
+ *   TickScheduler scheduler(1.0 / 30.0, TickScheduler::Overrun::CatchUp, 3);
+ *   while (true) {
+ *       uint32_t ticks = scheduler.wait(); //sleeps until the next deadline
+ *       for (uint32_t t = 0; t < ticks; ++t) {
+ *           auto start = TickScheduler::Clock::now();
+ *           //...update...
+ *           scheduler.add_phase_time(TickScheduler::Update, start);
+ *       }
+ *   }
+ *
+ * When a tick runs past the next deadline (an "overrun"), the deadlines missed meanwhile are either dropped
+ * (Overrun::Drop: the loop runs one tick and carries on from the next deadline still ahead) or caught up by running
+ * up to 'max_catch_up' extra ticks back-to-back (Overrun::CatchUp; any more than that are dropped).
+ *
+ * It also keeps telemetry -- tick/overrun/drop counts, a histogram of how late each wakeup was, and time per phase --
+ * which report() summarizes (and resets).
+ */
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+struct TickScheduler {
+	typedef std::chrono::steady_clock Clock;
+
+	enum class Overrun : uint8_t {
+		Drop,
+		CatchUp
+	};
+
+	TickScheduler(double period, Overrun overrun = Overrun::CatchUp, uint32_t max_catch_up = 3);
+
+	//sleep until the next deadline, then return how many ticks to run now (1, or more when catching up):
+	uint32_t wait();
+
+	//parts of a tick that are timed separately:
+	enum Phase : uint8_t {
+		Poll, //taking in what clients sent
+		Update, //simulation
+		Serialize, //encoding and queueing messages
+		PhaseCount
+	};
+	//add the time since 'start' to 'phase':
+	void add_phase_time(Phase phase, Clock::time_point start) {
+		add_phase_time(phase, Clock::now() - start);
+	}
+	void add_phase_time(Phase phase, Clock::duration duration) {
+		phase_time[phase] += duration;
+	}
+
+	//summarize telemetry since the last report (or since starting) on one line, and reset it:
+	std::string report();
+
+	//settings:
+	Clock::duration period;
+	Overrun overrun;
+	uint32_t max_catch_up;
+
+	//telemetry (since the last report):
+	uint64_t ticks = 0; //ticks run
+	uint64_t overruns = 0; //times a tick ended after the next deadline
+	uint64_t caught_up = 0; //(Overrun::CatchUp) ticks run back-to-back to catch up
+	uint64_t dropped = 0; //deadlines skipped without running a tick
+	//wakeups by lateness (how long after the deadline wait() returned): [0] is under 1us, and [i] is [2^(i-1), 2^i) us
+	// (the last bucket takes everything longer):
+	inline static constexpr uint32_t LatenessBuckets = 24;
+	std::array< uint64_t, LatenessBuckets > lateness{};
+	Clock::duration max_lateness = Clock::duration::zero();
+	std::array< Clock::duration, PhaseCount > phase_time{};
+	Clock::time_point report_start;
+
+	//internals:
+	Clock::time_point deadline; //of the next tick
+};
@@ -0,0 +1,173 @@
+#include "Trace.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+	struct Event {
+		enum Kind : uint32_t { Zone, Counter };
+		uint64_t time; //(Zone) begin, (Counter) when
+		uint64_t data; //(Zone) end, (Counter) value (a double's bits)
+		char const *name;
+		Kind kind;
+	};
+
+	//each thread's events (written only by that thread; read by dump()):
+	struct Ring {
+		uint32_t tid = 0;
+		std::string thread_name; //(guarded by State::mutex)
+		std::atomic< Event * > events{nullptr}; //RingEvents of them, allocated when first needed
+		std::atomic< uint64_t > written{0}; //events ever recorded (the newest is at (written - 1) % RingEvents)
+	};
+
+	struct State {
+		std::mutex mutex;
+		std::vector< Ring * > rings; //(never freed, so threads can record right up until the program exits)
+		std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	};
+	State &get_state() {
+		static State *state = new State;
+		return *state;
+	}
+
+	thread_local Ring *this_thread_ring = nullptr;
+	Ring &get_ring() {
+		if (!this_thread_ring) {
+			State &state = get_state();
+			std::unique_lock< std::mutex > lock(state.mutex);
+			this_thread_ring = new Ring;
+			state.rings.emplace_back(this_thread_ring);
+			this_thread_ring->tid = uint32_t(state.rings.size());
+			this_thread_ring->thread_name = "thread " + std::to_string(this_thread_ring->tid);
+		}
+		return *this_thread_ring;
+	}
+
+	void record(Event const &event) {
+		Ring &ring = get_ring();
+		Event *events = ring.events.load(std::memory_order_relaxed);
+		if (!events) {
+			events = new Event[Trace::RingEvents];
+			ring.events.store(events, std::memory_order_release);
+		}
+		uint64_t at = ring.written.load(std::memory_order_relaxed);
+		events[at % Trace::RingEvents] = event;
+		ring.written.store(at + 1, std::memory_order_release);
+	}
+
+	void write_string(std::ostream &out, char const *str) {
+		out << '"';
+		for (char const *c = str; *c; ++c) {
+			if (*c == '"' || *c == '\\') out << '\\' << *c;
+			else if (uint8_t(*c) < 0x20) out << ' ';
+			else out << *c;
+		}
+		out << '"';
+	}
+}
+
+namespace Trace {
+
+std::atomic< bool > recording{false};
+
+void start() {
+	get_state(); //(so the epoch is set before the first event)
+	recording.store(true, std::memory_order_relaxed);
+}
+
+void stop() {
+	recording.store(false, std::memory_order_relaxed);
+}
+
+uint64_t now() {
+	return uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now() - get_state().epoch).count());
+}
+
+void set_thread_name(std::string const &name) {
+	Ring &ring = get_ring();
+	std::unique_lock< std::mutex > lock(get_state().mutex);
+	ring.thread_name = name;
+}
+
+void record_counter(char const *name, double value) {
+	Event event;
+	event.time = now();
+	static_assert(sizeof(value) == sizeof(event.data), "doubles fit in event data");
+	memcpy(&event.data, &value, sizeof(value));
+	event.name = name;
+	event.kind = Event::Counter;
+	record(event);
+}
+
+void record_zone(char const *name, uint64_t begin, uint64_t end) {
+	Event event;
+	event.time = begin;
+	event.data = end;
+	event.name = name;
+	event.kind = Event::Zone;
+	record(event);
+}
+
+uint64_t dump(std::string const &filename) {
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) throw std::runtime_error("Failed to open '" + filename + "' to write trace.");
+
+	State &state = get_state();
+	std::unique_lock< std::mutex > lock(state.mutex);
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	out << std::fixed << std::setprecision(3);
+	bool first = true;
+	auto begin_event = [&]() {
+		if (!first) out << ",\n";
+		first = false;
+	};
+	std::vector< Event > events;
+	uint64_t total = 0;
+	for (Ring *ring : state.rings) {
+		begin_event();
+		out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << ring->tid << ",\"args\":{\"name\":";
+		write_string(out, ring->thread_name.c_str());
+		out << "}}";
+
+		Event const *ring_events = ring->events.load(std::memory_order_acquire);
+		if (!ring_events) continue;
+		//copy what's there, then leave out anything the thread may have overwritten meanwhile:
+		uint64_t written = ring->written.load(std::memory_order_acquire);
+		uint64_t from = (written > RingEvents ? written - RingEvents : 0);
+		events.assign(written - from, Event());
+		for (uint64_t i = from; i < written; ++i) {
+			events[i - from] = ring_events[i % RingEvents];
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t written_after = ring->written.load(std::memory_order_relaxed);
+		uint64_t intact_from = (written_after > RingEvents ? written_after - RingEvents : 0);
+		for (uint64_t i = std::max(from, intact_from); i < written; ++i) {
+			Event const &event = events[i - from];
+			begin_event();
+			out << "{\"ph\":\"" << (event.kind == Event::Zone ? 'X' : 'C') << "\",\"name\":";
+			write_string(out, event.name);
+			out << ",\"pid\":1,\"tid\":" << ring->tid << ",\"ts\":" << double(event.time) * 1e-3;
+			if (event.kind == Event::Zone) {
+				out << ",\"dur\":" << double(event.data - event.time) * 1e-3 << "}";
+			} else {
+				double value;
+				memcpy(&value, &event.data, sizeof(value));
+				out << ",\"args\":{\"value\":" << value << "}}";
+			}
+			total += 1;
+		}
+	}
+	out << "\n]}\n";
+	if (!out) throw std::runtime_error("Failed to write trace to '" + filename + "'.");
+	return total;
+}
+
+}
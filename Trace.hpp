@@ -0,0 +1,93 @@
+#pragma once
+
+//Lightweight timeline tracing, for seeing where frame and tick time goes:
+//
+//  void Game::update(float elapsed) {
+//      TRACE_ZONE("Game::update"); //times the rest of this scope
+//      Trace::Zone phase("move players"); //...or time consecutive phases with one zone:
+//      //...
+//      phase.next("advance bullets");
+//      //...
+//      Trace::counter("bullets", double(bullets.size()));
+//  }
+//
+//Nothing is recorded until Trace::start(); until then (and after Trace::stop()) each zone or counter costs one
+// relaxed atomic load and a branch. While recording, each thread writes events to a ring of its own (no locks, no
+// allocation after the first event), which keeps the most recent Trace::RingEvents of them.
+//Trace::dump() writes what the rings hold as Chrome trace-event JSON (open in https://ui.perfetto.dev or chrome://tracing).
+//
+//Names must outlive the trace (string literals, in practice); thread names are copied.
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+namespace Trace {
+
+//events kept per thread (older ones are overwritten):
+constexpr uint32_t RingEvents = 1 << 15;
+
+//is anything being recorded?
+extern std::atomic< bool > recording;
+inline bool enabled() { return recording.load(std::memory_order_relaxed); }
+
+//start / stop recording (events from earlier recordings stay in the rings until overwritten):
+void start();
+void stop();
+
+//write every thread's recorded events to 'filename' as Chrome trace JSON; returns how many (throws on failure):
+// (safe to call while other threads are recording; events overwritten during the dump are left out)
+uint64_t dump(std::string const &filename);
+
+//name the calling thread in dumps:
+void set_thread_name(std::string const &name);
+
+//nanoseconds on the trace clock (steady, since the program started):
+uint64_t now();
+
+//record a sample of a value that changes over time:
+void record_counter(char const *name, double value);
+inline void counter(char const *name, double value) {
+	if (enabled()) record_counter(name, value);
+}
+
+//record a span of time on the calling thread:
+void record_zone(char const *name, uint64_t begin, uint64_t end);
+
+//Zone times from its construction to its destruction (or to next() / end()):
+struct Zone {
+	explicit Zone(char const *name_) {
+		if (enabled()) {
+			name = name_;
+			begin = now();
+		}
+	}
+	~Zone() { end(); }
+	Zone(Zone const &) = delete;
+	Zone &operator=(Zone const &) = delete;
+
+	//end this zone and start another right away:
+	void next(char const *name_) {
+		end();
+		if (enabled()) {
+			name = name_;
+			begin = now();
+		}
+	}
+	void end() {
+		if (name) {
+			record_zone(name, begin, now());
+			name = nullptr;
+		}
+	}
+
+	char const *name = nullptr; //(nullptr if not recording)
+	uint64_t begin = 0;
+};
+
+}
+
+#define TRACE_CONCAT2(A, B) A ## B
+#define TRACE_CONCAT(A, B) TRACE_CONCAT2(A, B)
+//time the rest of the enclosing scope:
+#define TRACE_ZONE(NAME) Trace::Zone TRACE_CONCAT(trace_zone_, __LINE__)(NAME)
@@ -0,0 +1,78 @@
+#include "WorkerPool.hpp"
+#include "Trace.hpp"
+
+#include <cassert>
+
+WorkerPool::WorkerPool(uint32_t threads) {
+	if (threads == 0) threads = 1;
+	for (uint32_t w = 1; w < threads; ++w) {
+		helpers.emplace_back([this,w](){
+			Trace::set_thread_name("worker " + std::to_string(w));
+			uint64_t seen = 0;
+			while (true) {
+				{ //wait for a new job (or shutdown):
+					std::unique_lock< std::mutex > lock(mutex);
+					start_cv.wait(lock, [&](){ return quit || generation != seen; });
+					if (quit) return;
+					seen = generation;
+				}
+				work(w);
+				{ //report completion:
+					std::unique_lock< std::mutex > lock(mutex);
+					busy -= 1;
+					if (busy == 0) done_cv.notify_one();
+				}
+			}
+		});
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	start_cv.notify_all();
+	for (auto &helper : helpers) {
+		helper.join();
+	}
+}
+
+void WorkerPool::work(uint32_t worker) {
+	assert(job);
+	TRACE_ZONE("WorkerPool::work");
+	for (uint32_t i = worker; i < count; i += size()) {
+		(*job)(i);
+	}
+}
+
+void WorkerPool::run(uint32_t count_, std::function< void(uint32_t) > const &job_) {
+	if (count_ == 0) return;
+
+	//not worth waking anyone up:
+	if (helpers.empty() || count_ == 1) {
+		for (uint32_t i = 0; i < count_; ++i) {
+			job_(i);
+		}
+		return;
+	}
+
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		assert(busy == 0 && "WorkerPool::run is not re-entrant");
+		job = &job_;
+		count = count_;
+		busy = uint32_t(helpers.size());
+		generation += 1;
+	}
+	start_cv.notify_all();
+
+	//calling thread is worker zero:
+	work(0);
+
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		done_cv.wait(lock, [&](){ return busy == 0; });
+		job = nullptr;
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * WorkerPool is a fixed set of threads for fork-join style parallel loops:
+ *
+ *   WorkerPool pool(4); //the calling thread + 3 helper threads
+ *   pool.run(count, [&](uint32_t i){
+ *       //...work on item i...
+ *   });
+ *   //all items are done here
+ *
+ * Items are dealt out round-robin: worker 'w' always gets items w, w + size(), w + 2*size(), ...
+ * so the same item lands on the same thread every call (good for cache locality), and
+ * anything that depends on the item-to-worker mapping is reproducible.
+ */
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+struct WorkerPool {
+	//'threads' counts the calling thread, so WorkerPool(1) runs everything inline:
+	explicit WorkerPool(uint32_t threads);
+	~WorkerPool();
+
+	WorkerPool(WorkerPool const &) = delete;
+	WorkerPool &operator=(WorkerPool const &) = delete;
+
+	//call job(i) for every i in [0, count); returns once all calls have finished:
+	// (not re-entrant: don't call run() from inside a job)
+	void run(uint32_t count, std::function< void(uint32_t) > const &job);
+
+	//number of threads that work on run() calls (including the caller):
+	uint32_t size() const { return uint32_t(helpers.size()) + 1; }
+
+	//internals:
+	void work(uint32_t worker); //run this worker's share of the current job
+	std::vector< std::thread > helpers;
+	std::mutex mutex;
+	std::condition_variable start_cv, done_cv;
+	std::function< void(uint32_t) > const *job = nullptr;
+	uint32_t count = 0;
+	uint64_t generation = 0; //incremented once per run()
+	uint32_t busy = 0; //helpers still working on the current generation
+	bool quit = false;
+};
@@ -6,6 +6,7 @@
 #include "Sound.hpp"
 #include "GL.hpp"
 #include "load_save_png.hpp"
+#include "Trace.hpp"
 
 #include <SDL.h>
 
@@ -13,6 +14,7 @@
 #include <iostream>
 #include <stdexcept>
 #include <memory>
+#include <string>
 #include <algorithm>
 
 #ifdef _WIN32
@@ -34,13 +36,31 @@ int main(int argc, char **argv) {
 	try {
 #endif
 	//------------ command line arguments ------------
-	if (argc != 3) {
-		std::cerr << "Usage:\n\t./client <host> <port>" << std::endl;
+	Transport transport = Transport::TCP;
+	//F12 starts tracing (see Trace.hpp), then writes what was recorded here on each later press:
+	std::string trace_file = "trace.json";
+	auto usage = [&]() {
+		std::cerr << "Usage:\n\t./client <host> <port> [--udp | --shm] [--trace FILE]\n\t(--trace: record from launch, and write FILE when F12 is pressed)" << std::endl;
 		return 1;
+	};
+	if (argc < 3) return usage();
+	for (int i = 3; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--udp") {
+			transport = Transport::UDP;
+		} else if (arg == "--shm") {
+			transport = Transport::SharedMemory; //(server must be on this machine)
+		} else if (arg == "--trace" && i + 1 < argc) {
+			trace_file = argv[++i];
+			Trace::start();
+		} else {
+			return usage();
+		}
 	}
+	Trace::set_thread_name("main");
 
 	//------------ connect to server --------------
-	Client client(argv[1], argv[2]);
+	Client client(argv[1], argv[2], transport);
 
 	//------------  initialization ------------
 
@@ -160,12 +180,26 @@ int main(int argc, char **argv) {
 						px.a = 0xff;
 					}
 					save_png(filename, glm::uvec2(w,h), data.data(), LowerLeftOrigin);
+				} else if (evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_F12) {
+					// --- trace key ---
+					if (!Trace::enabled()) {
+						Trace::start();
+						std::cout << "Tracing; press F12 again to write the latest events to '" << trace_file << "'." << std::endl;
+					} else {
+						try {
+							uint64_t events = Trace::dump(trace_file);
+							std::cout << "Wrote " << events << " trace events to '" << trace_file << "'." << std::endl;
+						} catch (std::exception const &e) {
+							std::cerr << e.what() << std::endl;
+						}
+					}
 				}
 			}
 			if (!Mode::current) break;
 		}
 
 		{ //(2) call the current mode's "update" function to deal with elapsed time:
+			TRACE_ZONE("Mode::update");
 			auto current_time = std::chrono::high_resolution_clock::now();
 			static auto previous_time = current_time;
 			float elapsed = std::chrono::duration< float >(current_time - previous_time).count();
@@ -180,11 +214,12 @@ int main(int argc, char **argv) {
 		}
 
 		{ //(3) call the current mode's "draw" function to produce output:
-		
+			TRACE_ZONE("Mode::draw");
 			Mode::current->draw(drawable_size);
 		}
 
 		//Wait until the recently-drawn frame is shown before doing it all again:
+		TRACE_ZONE("SDL_GL_SwapWindow");
 		SDL_GL_SwapWindow(window);
 	}
 
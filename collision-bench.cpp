@@ -0,0 +1,116 @@
+//Microbenchmark for the batched box overlap kernels in Collision.hpp.
+// - first checks that every overlap_mask implementation agrees bit-for-bit with Game::check_collision,
+// - then times one query box against many boxes with each implementation.
+//Usage:
+//	./collision-bench [boxes] [queries]
+
+#include "Collision.hpp"
+#include "Game.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <limits>
+#include <string>
+#include <functional>
+
+int main(int argc, char **argv) {
+	uint32_t box_count = (argc > 1 ? uint32_t(std::stoul(argv[1])) : 4096);
+	uint32_t query_count = (argc > 2 ? uint32_t(std::stoul(argv[2])) : 4096);
+	box_count = (box_count + BoxBatch - 1) / BoxBatch * BoxBatch;
+
+	std::mt19937 mt(0x15466666);
+	//coordinates on a coarse lattice so that lots of boxes share edges exactly (the interesting case for '<' vs '<='):
+	auto coord = [&]() { return float(int(mt() % 64) - 32) * 0.0625f; };
+	auto random_box = [&](glm::vec2 *min, glm::vec2 *max) {
+		float x0 = coord(), x1 = coord(), y0 = coord(), y1 = coord();
+		*min = glm::vec2(std::min(x0, x1), std::min(y0, y1));
+		*max = glm::vec2(std::max(x0, x1), std::max(y0, y1));
+		if (mt() % 64 == 0) min->x = std::numeric_limits< float >::quiet_NaN(); //a few NaNs, too
+	};
+
+	BoxesSoA boxes;
+	for (uint32_t i = 0; i < box_count; ++i) {
+		glm::vec2 min, max;
+		random_box(&min, &max);
+		boxes.push(min, max);
+	}
+	std::vector< QueryBox > queries;
+	for (uint32_t i = 0; i < query_count; ++i) {
+		glm::vec2 min, max;
+		random_box(&min, &max);
+		queries.emplace_back(min, max);
+	}
+
+	Game game; //(check_collision is a Game member)
+	auto reference_mask = [&](QueryBox const &q, size_t first) {
+		uint32_t mask = 0;
+		for (uint32_t i = 0; i < BoxBatch; ++i) {
+			if (game.check_collision(q.left, boxes.left[first+i], q.right, boxes.right[first+i], q.top, boxes.top[first+i], q.bottom, boxes.bottom[first+i])) {
+				mask |= (1u << i);
+			}
+		}
+		return mask;
+	};
+
+	struct Implementation {
+		std::string name;
+		std::function< uint32_t(QueryBox const &, BoxesSoA const &, size_t) > fn;
+	};
+	std::vector< Implementation > implementations;
+	implementations.push_back({"scalar", overlap_mask_scalar});
+	#ifdef COLLISION_HAS_SSE2
+	implementations.push_back({"sse2", overlap_mask_sse2});
+	#endif
+	#ifdef COLLISION_HAS_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		implementations.push_back({"avx2", overlap_mask_avx2});
+	}
+	#endif
+
+	//------------ correctness ------------
+	for (auto const &impl : implementations) {
+		uint64_t mismatches = 0;
+		for (auto const &q : queries) {
+			for (size_t first = 0; first < boxes.size(); first += BoxBatch) {
+				if (impl.fn(q, boxes, first) != reference_mask(q, first)) ++mismatches;
+			}
+		}
+		if (mismatches) {
+			std::cerr << impl.name << ": " << mismatches << " batches differ from Game::check_collision!" << std::endl;
+			return 1;
+		}
+	}
+	std::cout << "All implementations match Game::check_collision on " << uint64_t(box_count) * query_count << " box pairs." << std::endl;
+	std::cout << "overlap_mask() dispatches to: " << overlap_mask_implementation() << std::endl;
+
+	//------------ timing ------------
+	auto time_it = [&](std::string const &name, std::function< uint32_t(QueryBox const &, size_t) > const &fn) {
+		uint32_t sink = 0;
+		auto before = std::chrono::high_resolution_clock::now();
+		for (auto const &q : queries) {
+			for (size_t first = 0; first < boxes.size(); first += BoxBatch) {
+				sink += fn(q, first);
+			}
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		double ns = std::chrono::duration< double, std::nano >(after - before).count();
+		std::cout << "  " << name << ": " << ns / (double(box_count) * query_count) << " ns / box pair (checksum " << sink << ")" << std::endl;
+	};
+
+	std::cout << "Timing " << query_count << " queries x " << box_count << " boxes:" << std::endl;
+	time_it("Game::check_collision", reference_mask);
+	//call through direct function pointers here so std::function overhead doesn't dominate:
+	time_it("overlap_mask_scalar", [&](QueryBox const &q, size_t first) { return overlap_mask_scalar(q, boxes, first); });
+	#ifdef COLLISION_HAS_SSE2
+	time_it("overlap_mask_sse2", [&](QueryBox const &q, size_t first) { return overlap_mask_sse2(q, boxes, first); });
+	#endif
+	#ifdef COLLISION_HAS_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		time_it("overlap_mask_avx2", [&](QueryBox const &q, size_t first) { return overlap_mask_avx2(q, boxes, first); });
+	}
+	#endif
+	time_it("overlap_mask (dispatched)", [&](QueryBox const &q, size_t first) { return overlap_mask(q, boxes, first); });
+
+	return 0;
+}
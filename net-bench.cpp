@@ -0,0 +1,291 @@
+//Benchmark for the server's socket I/O (IOMode), with no game in the way.
+// - a Server (on this, the "server" thread) polls until each tick's deadline, then queues one send_latest() message
+//   of 'bytes' shared bytes (plus a per-connection head) to every connection, as the game server does with its state,
+// - a second thread holds 'clients' plain TCP sockets to it, sends a small message on each per tick, and drains them,
+// - counts the system calls the server thread makes (by standing in for the libc functions Connection.cpp calls,
+//   and passing each along) and the CPU time it uses,
+// - prints one JSON object with the results per tick (so runs can be compared across IOModes and builds).
+//Usage:
+//	./net-bench [--clients N] [--ticks N] [--warmup N] [--bytes N] [--tick-rate HZ] [--io select|epoll|uring] [--port P]
+// (linux only)
+
+#include "Connection.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+//------------ system call counting ------------
+//these take the place of libc's versions (for Connection.cpp, too) and count calls made while 'counting' is set on the calling thread
+// (this covers every call Connection.cpp makes to move data or wait on sockets, for each IOMode and transport; bookkeeping
+//  calls -- socket setup, fcntl, setsockopt, close -- pass straight through to libc uncounted):
+
+static thread_local bool counting = false;
+static thread_local uint64_t syscall_count = 0;
+
+//look up libc's version of 'name' (once) and count the call:
+#define PASS_ALONG(name) \
+	static auto real = reinterpret_cast< decltype(&::name) >(dlsym(RTLD_NEXT, #name)); \
+	if (counting) syscall_count += 1;
+
+extern "C" {
+ssize_t send(int fd, void const *buf, size_t len, int flags) { PASS_ALONG(send); return real(fd, buf, len, flags); }
+ssize_t sendmsg(int fd, struct msghdr const *msg, int flags) { PASS_ALONG(sendmsg); return real(fd, msg, flags); }
+ssize_t sendto(int fd, void const *buf, size_t len, int flags, struct sockaddr const *addr, socklen_t addr_len) { PASS_ALONG(sendto); return real(fd, buf, len, flags, addr, addr_len); }
+ssize_t recv(int fd, void *buf, size_t len, int flags) { PASS_ALONG(recv); return real(fd, buf, len, flags); }
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags) { PASS_ALONG(recvmsg); return real(fd, msg, flags); }
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *addr, socklen_t *addr_len) { PASS_ALONG(recvfrom); return real(fd, buf, len, flags, addr, addr_len); }
+ssize_t read(int fd, void *buf, size_t count) { PASS_ALONG(read); return real(fd, buf, count); }
+ssize_t write(int fd, void const *buf, size_t count) { PASS_ALONG(write); return real(fd, buf, count); }
+int accept(int fd, struct sockaddr *addr, socklen_t *len) { PASS_ALONG(accept); return real(fd, addr, len); }
+int accept4(int fd, struct sockaddr *addr, socklen_t *len, int flags) { PASS_ALONG(accept4); return real(fd, addr, len, flags); }
+int epoll_wait(int epfd, struct epoll_event *events, int max, int timeout) { PASS_ALONG(epoll_wait); return real(epfd, events, max, timeout); }
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) noexcept { PASS_ALONG(epoll_ctl); return real(epfd, op, fd, event); }
+int poll(struct pollfd *fds, nfds_t count, int timeout) { PASS_ALONG(poll); return real(fds, count, timeout); }
+int select(int n, fd_set *r, fd_set *w, fd_set *e, struct timeval *timeout) { PASS_ALONG(select); return real(n, r, w, e, timeout); }
+long syscall(long number, ...) noexcept {
+	//(io_uring_enter and friends; none take more than six arguments)
+	va_list args;
+	va_start(args, number);
+	long a[6];
+	for (auto &x : a) x = va_arg(args, long);
+	va_end(args);
+	PASS_ALONG(syscall);
+	return real(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+}
+
+#undef PASS_ALONG
+
+static double thread_cpu_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return double(ts.tv_sec) + 1e-9 * double(ts.tv_nsec);
+}
+
+//------------ benchmark ------------
+
+typedef std::chrono::steady_clock Clock;
+
+int main(int argc, char **argv) {
+	uint32_t client_count = 500;
+	uint32_t tick_count = 600; //timed ticks
+	uint32_t warmup_count = 60; //untimed ticks first (everyone has connected and is receiving by the end)
+	uint32_t message_bytes = 1200; //shared bytes sent to every client per tick (about a state message)
+	float tick_rate = 30.0f;
+	IOMode io_mode = DefaultIOMode;
+	std::string io_name = "epoll";
+	std::string port = "15821";
+
+	auto usage = [&]() {
+		std::cerr << "Usage:\n\t./net-bench [--clients N] [--ticks N] [--warmup N] [--bytes N] [--tick-rate HZ] [--io select|epoll|uring] [--port P]" << std::endl;
+		return 1;
+	};
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--clients" && i + 1 < argc) {
+			client_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--ticks" && i + 1 < argc) {
+			tick_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--warmup" && i + 1 < argc) {
+			warmup_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--bytes" && i + 1 < argc) {
+			message_bytes = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--tick-rate" && i + 1 < argc) {
+			tick_rate = std::stof(argv[++i]);
+		} else if (arg == "--io" && i + 1 < argc) {
+			io_name = argv[++i];
+			if (io_name == "select") io_mode = IOMode::Select;
+			else if (io_name == "epoll") io_mode = IOMode::Epoll;
+			else if (io_name == "uring") io_mode = IOMode::Uring;
+			else return usage();
+		} else if (arg == "--port" && i + 1 < argc) {
+			port = argv[++i];
+		} else {
+			return usage();
+		}
+	}
+	if (client_count == 0 || tick_count == 0 || !(tick_rate > 0.0f)) return usage();
+	if (io_mode == IOMode::Select && client_count + 16 > FD_SETSIZE) {
+		std::cerr << "select() can only wait on " << FD_SETSIZE << " sockets; use fewer clients." << std::endl;
+		return 1;
+	}
+
+	Server server(port, Transport::TCP, io_mode);
+	if (server.io_mode != io_mode) io_name += " (fell back to " + std::string(server.io_mode == IOMode::Epoll ? "epoll" : "select") + ")";
+
+	//------------ clients ------------
+
+	std::atomic< bool > stop{false};
+	std::atomic< uint64_t > client_recv_bytes{0};
+	std::thread clients([&]() {
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		struct addrinfo *res = nullptr;
+		if (getaddrinfo("127.0.0.1", port.c_str(), &hints, &res) != 0) {
+			std::cerr << "getaddrinfo failed." << std::endl;
+			std::exit(1);
+		}
+		std::vector< int > sockets;
+		int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		for (uint32_t i = 0; i < client_count; ++i) {
+			int s = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+			if (s < 0 || connect(s, res->ai_addr, res->ai_addrlen) != 0) {
+				std::cerr << "client " << i << " failed to connect: " << strerror(errno) << std::endl;
+				std::exit(1);
+			}
+			int one = 1;
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+			struct epoll_event event;
+			event.events = EPOLLIN;
+			event.data.u32 = i;
+			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s, &event);
+			sockets.emplace_back(s);
+		}
+		freeaddrinfo(res);
+
+		std::vector< struct epoll_event > events(1024);
+		std::vector< char > buffer(1 << 16);
+		auto period = std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(1.0 / tick_rate));
+		Clock::time_point next_send = Clock::now();
+		while (!stop.load(std::memory_order_relaxed)) {
+			Clock::time_point now = Clock::now();
+			if (now >= next_send) {
+				//every client sends a little something (like controls) each tick:
+				uint8_t input[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+				for (int s : sockets) {
+					ssize_t ret = ::send(s, input, sizeof(input), MSG_NOSIGNAL);
+					(void)ret;
+				}
+				next_send += period;
+			}
+			int wait_ms = int(std::chrono::duration_cast< std::chrono::milliseconds >(next_send - now).count());
+			int count = epoll_wait(epoll_fd, events.data(), int(events.size()), std::max(0, std::min(wait_ms, 10)));
+			for (int e = 0; e < count; ++e) {
+				int s = sockets[events[e].data.u32];
+				while (true) {
+					ssize_t ret = ::recv(s, buffer.data(), buffer.size(), 0);
+					if (ret <= 0) break;
+					client_recv_bytes.fetch_add(uint64_t(ret), std::memory_order_relaxed);
+				}
+			}
+		}
+		for (int s : sockets) ::close(s);
+		::close(epoll_fd);
+	});
+
+	//------------ server ------------
+
+	bool timed = false; //(past warmup)
+	uint64_t server_recv_bytes = 0;
+	uint32_t closed = 0;
+	auto on_event = [&](Connection *c, Connection::Event event) {
+		if (event == Connection::OnRecv) {
+			if (timed) server_recv_bytes += c->recv_buffer.size();
+			c->recv_buffer.consume(c->recv_buffer.size());
+		} else if (event == Connection::OnClose) {
+			closed += 1;
+		}
+	};
+
+	std::vector< uint8_t > message(message_bytes);
+	for (size_t i = 0; i < message.size(); ++i) message[i] = uint8_t(i * 31);
+
+	uint64_t syscalls = 0;
+	double cpu = 0.0;
+	uint64_t sent_bytes = 0;
+	uint64_t client_bytes_before = 0;
+	auto period = std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(1.0 / tick_rate));
+	Clock::time_point deadline = Clock::now() + period;
+	for (uint32_t tick = 0; tick < warmup_count + tick_count; ++tick) {
+		timed = (tick >= warmup_count);
+		if (tick == warmup_count) {
+			if (server.connections.size() != client_count) {
+				std::cerr << "only " << server.connections.size() << " of " << client_count << " clients connected during warmup; try more --warmup." << std::endl;
+				stop = true;
+				clients.join();
+				return 1;
+			}
+			client_bytes_before = client_recv_bytes.load();
+		}
+		double cpu_before = thread_cpu_seconds();
+		counting = timed;
+
+		//wait out the rest of the tick, handling whatever comes in:
+		while (true) {
+			double remaining = std::chrono::duration< double >(deadline - Clock::now()).count();
+			if (remaining <= 0.0) break;
+			server.poll(on_event, remaining);
+		}
+		deadline += period;
+
+		//queue everyone's "state" (sent by the next poll):
+		SharedBytes body = std::make_shared< std::vector< uint8_t > const >(message);
+		for (auto &c : server.connections) {
+			if (!c) continue;
+			c.send_latest(&tick, sizeof(tick), body);
+			if (timed) sent_bytes += sizeof(tick) + body->size();
+		}
+
+		counting = false;
+		if (timed) {
+			syscalls += syscall_count;
+			cpu += thread_cpu_seconds() - cpu_before;
+		}
+		syscall_count = 0;
+	}
+	//(give the last tick's sends a moment to arrive)
+	server.poll(on_event, 0.1);
+	stop = true;
+	clients.join();
+	uint64_t delivered = client_recv_bytes.load() - client_bytes_before;
+
+	std::cout << std::fixed << std::setprecision(2) << "{"
+		<< "\"io\": \"" << io_name << "\""
+		<< ", \"clients\": " << client_count
+		<< ", \"ticks\": " << tick_count
+		<< ", \"tick_rate\": " << tick_rate
+		<< ", \"bytes\": " << message_bytes
+		<< ", \"syscalls_per_tick\": " << double(syscalls) / tick_count
+		<< ", \"cpu_us_per_tick\": " << 1e6 * cpu / tick_count
+		<< ", \"sent_bytes_per_tick\": " << double(sent_bytes) / tick_count
+		<< ", \"delivered_bytes_per_tick\": " << double(delivered) / tick_count
+		<< ", \"received_bytes_per_tick\": " << double(server_recv_bytes) / tick_count
+		<< ", \"closed\": " << closed
+		<< "}" << std::endl;
+
+	return 0;
+}
+
+#else
+
+int main(int, char **) {
+	std::cerr << "net-bench only runs on linux (it counts system calls by standing in for libc's functions)." << std::endl;
+	return 1;
+}
+
+#endif
@@ -4,12 +4,26 @@
 #include "hex_dump.hpp"
 
 #include "Game.hpp"
+#include "WorkerPool.hpp"
+#include "TickScheduler.hpp"
+#include "SPSCQueue.hpp"
+#include "Trace.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <csignal>
 #include <stdexcept>
 #include <iostream>
 #include <cassert>
 #include <unordered_map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+
+//set (by SIGUSR1) to ask for a trace dump:
+static std::atomic< bool > trace_dump_requested{false};
 
 #ifdef _WIN32
 extern "C" { uint32_t GetACP(); }
@@ -32,87 +46,455 @@ int main(int argc, char **argv) {
 
 	//------------ argument parsing ------------
 
-	if (argc != 2) {
-		std::cerr << "Usage:\n\t./server <port>" << std::endl;
+	std::string port;
+	uint32_t match_count = 1; //number of independent matches hosted by this process
+	uint32_t match_size = 8; //players per match
+	uint32_t thread_count = 1; //threads used to tick matches
+	float tick = Game::Tick; //seconds per simulation step (bullets are swept, so lower rates don't let them tunnel)
+	//matches are reproducible given their seed, so pick one (unless told) and report it:
+	uint64_t seed = uint64_t(std::chrono::system_clock::now().time_since_epoch().count());
+	Transport transport = Transport::TCP;
+	IOMode io_mode = DefaultIOMode;
+	//what to do when ticks fall behind (see TickScheduler):
+	TickScheduler::Overrun overrun = TickScheduler::Overrun::CatchUp;
+	uint32_t max_catch_up = 3;
+	std::string trace_file; //record a trace, and write it here when asked (see Trace.hpp)
+
+	auto usage = [&]() {
+		std::cerr << "Usage:\n\t./server <port> [--matches N] [--match-size N] [--threads N] [--tick-rate HZ] [--seed S] [--udp] [--io select|epoll|uring] [--overrun drop|catch-up] [--max-catch-up N] [--trace FILE]" << std::endl;
 		return 1;
+	};
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--matches" && i + 1 < argc) {
+			match_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--match-size" && i + 1 < argc) {
+			match_size = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--threads" && i + 1 < argc) {
+			thread_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--tick-rate" && i + 1 < argc) {
+			tick = 1.0f / std::stof(argv[++i]);
+		} else if (arg == "--seed" && i + 1 < argc) {
+			seed = std::stoull(argv[++i]);
+		} else if (arg == "--udp") {
+			transport = Transport::UDP;
+		} else if (arg == "--io" && i + 1 < argc) {
+			std::string mode = argv[++i];
+			if (mode == "select") io_mode = IOMode::Select;
+			else if (mode == "epoll") io_mode = IOMode::Epoll;
+			else if (mode == "uring") io_mode = IOMode::Uring;
+			else return usage();
+		} else if (arg == "--overrun" && i + 1 < argc) {
+			std::string policy = argv[++i];
+			if (policy == "drop") overrun = TickScheduler::Overrun::Drop;
+			else if (policy == "catch-up") overrun = TickScheduler::Overrun::CatchUp;
+			else return usage();
+		} else if (arg == "--max-catch-up" && i + 1 < argc) {
+			max_catch_up = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--trace" && i + 1 < argc) {
+			trace_file = argv[++i];
+		} else if (port.empty() && arg.substr(0, 2) != "--") {
+			port = arg;
+		} else {
+			return usage();
+		}
 	}
+	if (port.empty() || match_count == 0 || match_size == 0 || !(tick > 0.0f)) return usage();
+	if (match_size > Game::MaxPlayers) {
+		std::cerr << "A match can have at most " << Game::MaxPlayers << " players." << std::endl;
+		return 1;
+	}
+
+	std::cout << "Hosting " << match_count << " match(es) of up to " << match_size << " players on " << thread_count << " thread(s); seed " << seed << " (match i uses seed + i)." << std::endl;
 
 	//------------ initialization ------------
 
-	Server server(argv[1]);
+	Trace::set_thread_name("simulation");
+	if (!trace_file.empty()) {
+		Trace::start();
+		#ifdef SIGUSR1
+		std::signal(SIGUSR1, [](int){ trace_dump_requested = true; });
+		std::cout << "Tracing; send SIGUSR1 (e.g., 'kill -USR1 <pid>') to write the latest events to '" << trace_file << "'." << std::endl;
+		#else
+		std::cout << "Tracing, but there's no SIGUSR1 here to ask for a dump." << std::endl;
+		#endif
+	}
 
-	//------------ main loop ------------
+	Server server(port, transport, io_mode);
 
-	//keep track of which connection is controlling which player:
-	std::unordered_map< Connection *, Player * > connection_to_player;
-	//keep track of game state:
-	Game game;
+	//worker threads that tick the matches:
+	WorkerPool workers(thread_count);
 
-	while (true) {
-		static auto next_tick = std::chrono::steady_clock::now() + std::chrono::duration< double >(Game::Tick);
-		//process incoming data from clients until a tick has elapsed:
-		while (true) {
-			auto now = std::chrono::steady_clock::now();
-			double remain = std::chrono::duration< double >(next_tick - now).count();
-			if (remain < 0.0) {
-				next_tick += std::chrono::duration< double >(Game::Tick);
-				break;
+	//Sockets are handled on a network thread of their own, so a slow tick doesn't hold up reading and writing them,
+	// and a burst of network work doesn't hold up the tick. The two threads only talk through queues:
+	// - the network thread reads messages into Inbound items, and the simulation takes all of them at the start of
+	//   each tick (so every tick sees exactly the input that had arrived by then);
+	// - each match queues Outbound items (encoded messages) as it ticks, then the network thread is woken to send them.
+	//Only the network thread touches Connections; the simulation knows them by number.
+
+	//what the network thread got from a client:
+	struct Inbound {
+		enum Kind : uint8_t { Open, Close, Controls, Ping, Ack } kind = Open;
+		uint32_t connection = 0;
+		Player::Controls::Received controls; //(Controls)
+		uint32_t token = 0; //(Ping)
+		uint32_t tick = 0, roster_version = 0; //(Ack)
+	};
+	SPSCQueue< Inbound > inbox;
+
+	//what the simulation has for a client:
+	struct Outbound {
+		enum Kind : uint8_t { Shared, State, Pong } kind = Shared;
+		uint32_t connection = 0;
+		SharedBytes bytes; //(Shared) whole message, (State) body
+		uint8_t head[Game::StateHeadSize] = {}; //(State) bytes before the body
+		uint32_t head_size = 0;
+		uint32_t token = 0; //(Pong)
+	};
+
+	//each match is an independent game with its own players:
+	struct Match {
+		Match(uint64_t seed) : game(seed) { }
+		//keep track of which connection is controlling which player:
+		std::unordered_map< uint32_t, Player * > connection_to_player;
+		//latest ping token from each connection, echoed after the next state message:
+		std::unordered_map< uint32_t, uint32_t > pending_pongs;
+		//what each connection has acknowledged:
+		struct Acked {
+			uint32_t tick = Snapshot::NoTick; //latest state tick (state is sent as changes from it)
+			uint32_t roster_version = 0; //latest roster
+			//roster last sent to it, and when (it's resent every so often until acked, in case it was lost):
+			uint32_t roster_sent_version = 0;
+			uint32_t roster_sent_tick = Snapshot::NoTick;
+		};
+		std::unordered_map< uint32_t, Acked > acked;
+		//messages for the network thread to send (pushed by whichever worker ticks this match):
+		SPSCQueue< Outbound > outbox;
+		//time spent on this match's last tick (by whichever worker ran it; see TickScheduler::Phase):
+		TickScheduler::Clock::duration update_time{}, serialize_time{};
+		//keep track of game state:
+		Game game;
+	};
+	//ticks to wait for a roster ack before sending the roster again:
+	constexpr uint32_t RosterResendTicks = 15;
+	std::vector< std::unique_ptr< Match > > matches;
+	for (uint32_t i = 0; i < match_count; ++i) {
+		matches.emplace_back(std::make_unique< Match >(seed + i));
+	}
+
+	//a lone match gets the worker threads to itself, to split up its update:
+	// (with several matches, the threads are already busy running matches side-by-side)
+	if (matches.size() == 1) {
+		matches[0]->game.workers = &workers;
+	}
+
+	//connections the simulation turned away (the network thread closes them):
+	SPSCQueue< uint32_t > turned_away;
+
+	//------------ network thread ------------
+
+	std::thread network([&](){
+		Trace::set_thread_name("network");
+		std::unordered_map< Connection *, uint32_t > connection_ids;
+		std::unordered_map< uint32_t, Connection * > id_connections;
+		uint32_t next_id = 1;
+
+		//stop talking about 'c' (telling the simulation, unless it was the one that asked):
+		auto forget = [&](Connection *c, bool tell) {
+			auto f = connection_ids.find(c);
+			if (f == connection_ids.end()) return;
+			if (tell) {
+				Inbound in;
+				in.kind = Inbound::Close;
+				in.connection = f->second;
+				inbox.push(std::move(in));
 			}
+			id_connections.erase(f->second);
+			connection_ids.erase(f);
+		};
 
-			//helper used on client close (due to quit) and server close (due to error):
-			auto remove_connection = [&](Connection *c) {
-				auto f = connection_to_player.find(c);
-				assert(f != connection_to_player.end());
-				game.remove_player(f->second);
-				connection_to_player.erase(f);
-			};
+		//(poll() returns as soon as the simulation has something to send -- see Server::wake -- except on windows, so check often there)
+		#ifdef _WIN32
+		constexpr double PollTimeout = 0.001;
+		#else
+		constexpr double PollTimeout = 0.1;
+		#endif
+
+		while (true) {
+			//hand what the simulation queued to the connections:
+			uint32_t refused;
+			while (turned_away.pop(&refused)) {
+				auto f = id_connections.find(refused);
+				if (f == id_connections.end()) continue;
+				Connection *c = f->second;
+				c->close();
+				forget(c, false);
+			}
+			for (auto &match : matches) {
+				Outbound out;
+				while (match->outbox.pop(&out)) {
+					auto f = id_connections.find(out.connection);
+					if (f == id_connections.end()) continue; //(gone since)
+					Connection *c = f->second;
+					if (out.kind == Outbound::Shared) {
+						c->send_shared(out.bytes);
+					} else if (out.kind == Outbound::State) {
+						//only the newest state matters (see Game::send_state_message):
+						c->send_latest(out.head, out.head_size, out.bytes);
+					} else { assert(out.kind == Outbound::Pong);
+						send_ping_message(c, Message::S2C_Pong, out.token);
+					}
+				}
+			}
 
 			server.poll([&](Connection *c, Connection::Event evt){
 				if (evt == Connection::OnOpen) {
-					//client connected:
-
-					//create some player info for them:
-					connection_to_player.emplace(c, game.spawn_player());
+					//client connected (the simulation decides which match it joins, if any):
+					uint32_t id = next_id++;
+					connection_ids.emplace(c, id);
+					id_connections.emplace(id, c);
+					Inbound in;
+					in.kind = Inbound::Open;
+					in.connection = id;
+					inbox.push(std::move(in));
 
 				} else if (evt == Connection::OnClose) {
 					//client disconnected:
 
-					remove_connection(c);
+					forget(c, true);
 
 				} else { assert(evt == Connection::OnRecv);
 					//got data from client:
-					//std::cout << "current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
+					//std::cout << "current buffer:\n" << hex_dump(c->recv_buffer.data(), c->recv_buffer.size()); std::cout.flush(); //DEBUG
 
-					//look up in players list:
-					auto f = connection_to_player.find(c);
-					assert(f != connection_to_player.end());
-					Player &player = *f->second;
+					auto f = connection_ids.find(c);
+					assert(f != connection_ids.end());
 
-					//handle messages from client:
+					//read messages from client, to be handled on the next tick:
 					try {
 						bool handled_message;
 						do {
-							handled_message = false;
-							if (player.controls.recv_controls_message(c)) handled_message = true;
+							Inbound in;
+							in.connection = f->second;
+							handled_message = true;
+							if (Player::Controls::recv_controls_message(c, &in.controls)) {
+								in.kind = Inbound::Controls;
+							} else if (recv_ping_message(c, Message::C2S_Ping, &in.token)) {
+								in.kind = Inbound::Ping;
+							} else if (recv_ack_message(c, &in.tick, &in.roster_version)) {
+								in.kind = Inbound::Ack;
+							} else {
+								handled_message = false;
+							}
 							//TODO: extend for more message types as needed
+							if (handled_message) inbox.push(std::move(in));
 						} while (handled_message);
 					} catch (std::exception const &e) {
 						std::cout << "Disconnecting client:" << e.what() << std::endl;
 						c->close();
-						remove_connection(c);
+						forget(c, true);
+					}
+				}
+			}, PollTimeout);
+			Trace::counter("connections", double(server.connections.size()));
+
+			//now and then, report on clients that aren't keeping up with what is sent to them:
+			static auto next_report = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+			if (std::chrono::steady_clock::now() >= next_report) {
+				next_report += std::chrono::seconds(10);
+				uint32_t backed_up = 0;
+				size_t peak_backlog = 0;
+				uint64_t superseded = 0;
+				for (auto &c : server.connections) {
+					if (c.peak_backlog > 0) backed_up += 1;
+					peak_backlog = std::max(peak_backlog, c.peak_backlog);
+					superseded += c.superseded;
+					c.peak_backlog = 0;
+					c.superseded = 0;
+				}
+				if (backed_up > 0 || superseded > 0) {
+					std::cout << "Send queues over the last 10s: " << backed_up << " connection(s) backed up (peak backlog " << peak_backlog << " bytes); "
+					          << superseded << " state message(s) replaced by newer ones before going out." << std::endl;
+				}
+			}
+		}
+	});
+
+	//------------ main loop ------------
+
+	//which match each connection was routed to:
+	std::unordered_map< uint32_t, Match * > connection_to_match;
+
+	TickScheduler scheduler(tick, overrun, max_catch_up);
+	uint32_t ticks_due = 0; //(more than one after an overrun, when catching up)
+	auto next_report = TickScheduler::Clock::now() + std::chrono::seconds(10);
+
+	while (true) {
+		//wait for the next tick (the network thread handles clients meanwhile):
+		if (ticks_due == 0) ticks_due = scheduler.wait();
+		ticks_due -= 1;
+		Trace::Zone tick_zone("tick");
+		auto poll_start = TickScheduler::Clock::now();
+
+		//helper used on client close (due to quit) and server close (due to error):
+		auto remove_connection = [&](uint32_t c) {
+			auto m = connection_to_match.find(c);
+			if (m == connection_to_match.end()) return; //(was turned away on connect)
+			Match &match = *m->second;
+			auto f = match.connection_to_player.find(c);
+			assert(f != match.connection_to_player.end());
+			match.game.remove_player(f->second);
+			match.connection_to_player.erase(f);
+			match.pending_pongs.erase(c);
+			match.acked.erase(c);
+			connection_to_match.erase(m);
+		};
+
+		//handle everything clients sent since the last tick:
+		Inbound in;
+		while (inbox.pop(&in)) {
+			uint32_t c = in.connection;
+			if (in.kind == Inbound::Open) {
+				//client connected:
+
+				//route to the first match with a free slot:
+				Match *match = nullptr;
+				for (auto &m : matches) {
+					if (m->connection_to_player.size() < match_size) {
+						match = m.get();
+						break;
 					}
 				}
-			}, remain);
+				if (!match) {
+					std::cout << "All matches are full; turning away connection." << std::endl;
+					turned_away.push(uint32_t(c));
+					continue;
+				}
+
+				//create some player info for them:
+				Player *player = match->game.spawn_player();
+				match->connection_to_player.emplace(c, player);
+				connection_to_match.emplace(c, match);
+				continue;
+			}
+
+			if (in.kind == Inbound::Close) {
+				//client disconnected:
+
+				remove_connection(c);
+				continue;
+			}
+
+			//look up in players list:
+			auto m = connection_to_match.find(c);
+			if (m == connection_to_match.end()) continue; //(turned away, but had already sent something)
+			Match &match = *m->second;
+			auto f = match.connection_to_player.find(c);
+			assert(f != match.connection_to_player.end());
+			Player &player = *f->second;
+
+			//handle messages from client:
+			if (in.kind == Inbound::Controls) {
+				player.controls.apply(in.controls);
+			} else if (in.kind == Inbound::Ping) {
+				match.pending_pongs[c] = in.token;
+			} else { assert(in.kind == Inbound::Ack);
+				Match::Acked &acked = match.acked[c];
+				acked.tick = std::max(acked.tick, in.tick);
+				acked.roster_version = std::max(acked.roster_version, in.roster_version);
+			}
+		}
+		scheduler.add_phase_time(TickScheduler::Poll, poll_start);
+
+		//update each match and queue its state for its clients:
+		// (matches share nothing -- each connection belongs to exactly one match -- so they can run on any worker)
+		workers.run(uint32_t(matches.size()), [&](uint32_t i){
+			Match &match = *matches[i];
+			if (match.connection_to_player.empty()) return; //nobody playing
+
+			//update current game state
+			auto update_start = TickScheduler::Clock::now();
+			match.game.update(tick);
+			uint32_t state_tick = match.game.record_snapshot(tick);
+			auto serialize_start = TickScheduler::Clock::now();
+			match.update_time = serialize_start - update_start;
+
+			//send the roster to anyone who hasn't acked the latest (ahead of the state that refers to its players):
+			SharedBytes roster; //(encoded only if needed, then shared)
+			for (auto const &[c, player] : match.connection_to_player) {
+				Match::Acked &acked = match.acked[c];
+				if (acked.roster_version == match.game.roster_version) continue;
+				if (acked.roster_sent_version == match.game.roster_version && state_tick - acked.roster_sent_tick < RosterResendTicks) continue;
+				if (!roster) roster = match.game.encode_roster_message();
+				Outbound out;
+				out.kind = Outbound::Shared;
+				out.connection = c;
+				out.bytes = roster;
+				match.outbox.push(std::move(out));
+				acked.roster_sent_version = match.game.roster_version;
+				acked.roster_sent_tick = state_tick;
+			}
+
+			//send updated game state to all clients:
+			// (each body is the changes from a baseline tick, encoded once and shared by every client that acknowledged that tick;
+			//  each client's header says which player is theirs, with what it needs for prediction)
+			std::vector< std::pair< uint32_t, SharedBytes > > bodies;
+			for (auto const &[c, player] : match.connection_to_player) {
+				uint32_t baseline = Snapshot::NoTick;
+				auto a = match.acked.find(c);
+				if (a != match.acked.end() && match.game.find_snapshot(a->second.tick)) baseline = a->second.tick;
+
+				auto b = std::find_if(bodies.begin(), bodies.end(), [&](auto const &body) { return body.first == baseline; });
+				if (b == bodies.end()) {
+					bodies.emplace_back(baseline, match.game.encode_state_body(state_tick, baseline));
+					b = bodies.end() - 1;
+				}
+				Outbound out;
+				out.kind = Outbound::State;
+				out.connection = c;
+				out.bytes = b->second;
+				out.head_size = Game::encode_state_head(b->second, player, out.head);
+				match.outbox.push(std::move(out));
+
+				auto p = match.pending_pongs.find(c);
+				if (p != match.pending_pongs.end()) {
+					Outbound pong;
+					pong.kind = Outbound::Pong;
+					pong.connection = c;
+					pong.token = p->second;
+					match.outbox.push(std::move(pong));
+					match.pending_pongs.erase(p);
+				}
+			}
+			match.serialize_time = TickScheduler::Clock::now() - serialize_start;
+		});
+		for (auto &match : matches) {
+			//(summed over matches, so with several threads this is work done, not time taken)
+			scheduler.add_phase_time(TickScheduler::Update, match->update_time);
+			scheduler.add_phase_time(TickScheduler::Serialize, match->serialize_time);
+			match->update_time = match->serialize_time = TickScheduler::Clock::duration::zero();
 		}
 
-		//update current game state
-		game.update(Game::Tick);
+		//hand it all to the network thread:
+		server.wake();
+		tick_zone.end();
 
-		//send updated game state to all clients
-		for (auto &[c, player] : connection_to_player) {
-			game.send_state_message(c, player);
+		//now and then, report on how ticks are keeping up (while anyone is playing, or whenever they fall behind):
+		if (TickScheduler::Clock::now() >= next_report) {
+			next_report += std::chrono::seconds(10);
+			bool behind = (scheduler.overruns > 0 || scheduler.dropped > 0);
+			std::string report = scheduler.report();
+			if (!connection_to_match.empty() || behind) std::cout << report << std::endl;
 		}
 
+		if (trace_dump_requested.exchange(false)) {
+			try {
+				uint64_t events = Trace::dump(trace_file);
+				std::cout << "Wrote " << events << " trace events to '" << trace_file << "'." << std::endl;
+			} catch (std::exception const &e) {
+				std::cerr << e.what() << std::endl;
+			}
+		}
 	}
 
 
@@ -0,0 +1,282 @@
+//Headless benchmark for Game::update (no sockets, no window).
+// - spawns players scattered over the arena and drives them with synthetic controls,
+// - keeps the live bullet count topped up to a target (so bullet load doesn't depend on who is shooting),
+// - refills dead players' HP (so they keep shooting and the load stays steady),
+// - times every update() and counts heap allocations made inside it,
+// - (outside the timed part) encodes each tick's state message in full and as a delta from the tick 'ack-delay' ticks back,
+//   decodes the delta on a simulated client, and checks it reproduces the server's snapshot exactly,
+// - prints one JSON object with the results (so runs can be compared across builds),
+// - (with --trace) records the timed ticks and writes them to FILE as a Chrome trace (see Trace.hpp).
+//Usage:
+//	./sim-bench [--players N] [--bullets N] [--ticks N] [--warmup N] [--threads N] [--controls random|scripted|idle] [--seed S] [--ack-delay N] [--trace FILE]
+
+#include "Game.hpp"
+#include "WorkerPool.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//------------ allocation counting ------------
+//every global operator new goes through here, so allocations made by Game (or the standard library on its behalf) are counted:
+
+static std::atomic< uint64_t > allocation_count{0};
+static std::atomic< uint64_t > allocation_bytes{0};
+
+static void *counted_alloc(std::size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+	if (size == 0) size = 1;
+	void *ret = std::malloc(size);
+	if (!ret) throw std::bad_alloc();
+	return ret;
+}
+
+void *operator new(std::size_t size) { return counted_alloc(size); }
+void *operator new[](std::size_t size) { return counted_alloc(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+//------------ benchmark ------------
+
+int main(int argc, char **argv) {
+	uint32_t player_count = 64;
+	uint32_t bullet_count = 1000; //live bullets to keep in the arena
+	uint32_t tick_count = 3000; //timed ticks
+	uint32_t warmup_count = 100; //untimed ticks first (lets containers grow to their steady-state size)
+	uint32_t thread_count = 1;
+	std::string controls = "random";
+	uint64_t seed = Game::DefaultSeed;
+	uint32_t ack_delay = 3; //ticks between a state message being sent and its ack reaching the server (~ round trip time)
+	std::string trace_file;
+
+	auto usage = [&]() {
+		std::cerr << "Usage:\n\t./sim-bench [--players N] [--bullets N] [--ticks N] [--warmup N] [--threads N] [--controls random|scripted|idle] [--seed S] [--ack-delay N] [--trace FILE]" << std::endl;
+		return 1;
+	};
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--players" && i + 1 < argc) {
+			player_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--bullets" && i + 1 < argc) {
+			bullet_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--ticks" && i + 1 < argc) {
+			tick_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--warmup" && i + 1 < argc) {
+			warmup_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--threads" && i + 1 < argc) {
+			thread_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--controls" && i + 1 < argc) {
+			controls = argv[++i];
+		} else if (arg == "--seed" && i + 1 < argc) {
+			seed = std::stoull(argv[++i]);
+		} else if (arg == "--ack-delay" && i + 1 < argc) {
+			ack_delay = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--trace" && i + 1 < argc) {
+			trace_file = argv[++i];
+		} else {
+			return usage();
+		}
+	}
+	if (player_count > Game::MaxPlayers || tick_count == 0 || ack_delay == 0 || ack_delay >= Game::SnapshotHistory || !(controls == "random" || controls == "scripted" || controls == "idle")) return usage();
+
+	Game game(seed);
+	WorkerPool workers(thread_count);
+	game.workers = &workers;
+
+	//the harness's own randomness (kept separate from game.rng so the simulation sees the same stream as a real match):
+	Random harness(seed, 0x5eed);
+	auto unit = [&]() { return harness() / float(harness.max()); };
+	auto arena_point = [&]() {
+		return glm::vec2(
+			glm::mix(Game::ArenaMin.x, Game::ArenaMax.x, unit()),
+			glm::mix(Game::ArenaMin.y, Game::ArenaMax.y, unit())
+		);
+	};
+
+	for (uint32_t i = 0; i < player_count; ++i) {
+		Player *player = game.spawn_player();
+		player->position = arena_point();
+	}
+
+	auto drive_players = [&](uint32_t tick) {
+		uint32_t index = 0;
+		for (auto &p : game.players) {
+			if (p.HP <= 0) p.HP = 100;
+			Button *buttons[6] = {&p.controls.left, &p.controls.right, &p.controls.up, &p.controls.down, &p.controls.jump, &p.controls.shoot};
+			if (controls == "random") {
+				//flip each button now and then:
+				for (Button *b : buttons) {
+					if (harness() % 8 == 0) b->pressed = !b->pressed;
+				}
+			} else if (controls == "scripted") {
+				//run back and forth, hop, and fire, staggered per player:
+				uint32_t t = tick + index * 7;
+				bool forward = (t / 60) % 2 == 0;
+				p.controls.left.pressed = p.controls.down.pressed = !forward;
+				p.controls.right.pressed = p.controls.up.pressed = forward;
+				p.controls.jump.pressed = (t % 45) < 3;
+				p.controls.shoot.pressed = (t % 10) < 5;
+			}
+			++index;
+		}
+	};
+
+	//top up to 'bullet_count' live bullets (in Game::UnownedColor, so they can hit anyone):
+	game.bullets.reserve(bullet_count + player_count);
+	auto add_bullets = [&]() {
+		while (game.bullets.size() < bullet_count) {
+			glm::vec2 velocity(0.0f);
+			velocity[harness() % 2] = (harness() % 2 ? Game::BulletSpeed : -Game::BulletSpeed);
+			game.bullets.push(arena_point(), velocity, Game::UnownedColor, game.next_bullet_id++);
+		}
+	};
+
+	//state messages, delivered to a simulated client that acks every tick (the server hears of each ack 'ack_delay' ticks later):
+	Game client;
+	Connection link; //(no socket; messages are moved from its send side to its receive side by hand)
+	uint64_t full_bytes = 0;
+	uint64_t delta_bytes = 0;
+	uint32_t mismatches = 0; //ticks where the client's decoded snapshot differs from the server's
+	glm::vec2 max_error(0.0f); //largest difference between a position the client decoded and the server's real one
+	std::unordered_map< uint32_t, glm::vec2 > real_positions; //(by player or bullet id)
+	auto track_error = [&](uint32_t id, glm::vec2 const &position) {
+		auto f = real_positions.find(id);
+		if (f == real_positions.end()) {
+			++mismatches;
+			return;
+		}
+		max_error.x = std::max(max_error.x, std::abs(position.x - f->second.x));
+		max_error.y = std::max(max_error.y, std::abs(position.y - f->second.y));
+	};
+	auto same_state = [](Snapshot const &a, Snapshot const &b) {
+		if (a.tick != b.tick || a.players.size() != b.players.size() || a.bullets.size() != b.bullets.size()) return false;
+		for (size_t i = 0; i < a.players.size(); ++i) {
+			auto const &pa = a.players[i];
+			auto const &pb = b.players[i];
+			if (pa.id != pb.id || pa.position[0] != pb.position[0] || pa.position[1] != pb.position[1] || pa.velocity[0] != pb.velocity[0] || pa.velocity[1] != pb.velocity[1]
+			 || pa.color != pb.color || pa.gravity != pb.gravity || pa.HP != pb.HP) return false;
+		}
+		for (size_t i = 0; i < a.bullets.size(); ++i) {
+			auto const &ba = a.bullets[i];
+			auto const &bb = b.bullets[i];
+			if (ba.id != bb.id || ba.position != bb.position || ba.velocity != bb.velocity || ba.color != bb.color) return false;
+		}
+		return true;
+	};
+	auto send_state = [&]() {
+		uint32_t tick = game.record_snapshot(Game::Tick);
+		uint32_t baseline = (tick > ack_delay ? tick - ack_delay : Snapshot::NoTick);
+		SharedBytes body = game.encode_state_body(tick, baseline);
+		full_bytes += game.encode_state_body(tick)->size();
+		delta_bytes += body->size();
+
+		Game::send_state_message(&link, body, &game.players.front());
+		link.recv_buffer.append(link.send_buffer.data(), link.send_buffer.size());
+		for (auto const &shared : link.shared_sends) {
+			link.recv_buffer.append(shared.head, shared.head_size);
+			link.recv_buffer.append(shared.bytes->data(), shared.bytes->size());
+		}
+		link.send_buffer.clear();
+		link.shared_sends.clear();
+		if (!client.recv_state_message(&link) || !same_state(*client.find_snapshot(tick), *game.find_snapshot(tick))) ++mismatches;
+		link.send_buffer.clear(); //(the client's ack)
+
+		real_positions.clear();
+		for (auto const &p : game.players) real_positions.emplace(p.id, p.position);
+		for (auto const &p : client.players) track_error(p.id, p.position);
+		real_positions.clear();
+		for (size_t b = 0; b < game.bullets.size(); ++b) real_positions.emplace(game.bullets.ids[b], game.bullets.positions[b]);
+		for (size_t b = 0; b < client.bullets.size(); ++b) track_error(client.bullets.ids[b], client.bullets.positions[b]);
+	};
+
+	for (uint32_t tick = 0; tick < warmup_count; ++tick) {
+		drive_players(tick);
+		add_bullets();
+		game.update(Game::Tick);
+		send_state();
+	}
+	full_bytes = delta_bytes = 0;
+	mismatches = 0;
+	max_error = glm::vec2(0.0f);
+	if (!trace_file.empty()) Trace::start();
+
+	std::vector< double > tick_ns;
+	tick_ns.reserve(tick_count);
+	uint64_t allocations = 0;
+	uint64_t allocated_bytes = 0;
+	uint64_t live_bullets = 0;
+	int64_t damage = 0; //(total HP lost; a cheap check that two builds simulated the same thing)
+	auto total_hp = [&]() {
+		int64_t hp = 0;
+		for (auto const &p : game.players) hp += p.HP;
+		return hp;
+	};
+	for (uint32_t tick = 0; tick < tick_count; ++tick) {
+		drive_players(warmup_count + tick);
+		add_bullets();
+		live_bullets += game.bullets.size();
+		int64_t hp_before = total_hp();
+
+		uint64_t count_before = allocation_count.load(std::memory_order_relaxed);
+		uint64_t bytes_before = allocation_bytes.load(std::memory_order_relaxed);
+		auto before = std::chrono::steady_clock::now();
+		game.update(Game::Tick);
+		auto after = std::chrono::steady_clock::now();
+		allocations += allocation_count.load(std::memory_order_relaxed) - count_before;
+		allocated_bytes += allocation_bytes.load(std::memory_order_relaxed) - bytes_before;
+
+		tick_ns.emplace_back(std::chrono::duration< double, std::nano >(after - before).count());
+		damage += hp_before - total_hp();
+
+		send_state();
+	}
+	if (!trace_file.empty()) {
+		Trace::stop();
+		Trace::dump(trace_file);
+	}
+
+	double total_ns = 0.0;
+	for (double ns : tick_ns) total_ns += ns;
+	std::sort(tick_ns.begin(), tick_ns.end());
+	auto percentile = [&](double p) {
+		return tick_ns[std::min(tick_ns.size() - 1, size_t(p * tick_ns.size()))];
+	};
+
+	std::cout << std::fixed << std::setprecision(1) << "{"
+		<< "\"players\": " << player_count
+		<< ", \"bullets\": " << bullet_count
+		<< ", \"threads\": " << workers.size()
+		<< ", \"controls\": \"" << controls << "\""
+		<< ", \"seed\": " << seed
+		<< ", \"ticks\": " << tick_count
+		<< ", \"warmup\": " << warmup_count
+		<< ", \"overlap_mask\": \"" << overlap_mask_implementation() << "\""
+		<< ", \"ns_per_tick\": " << total_ns / tick_count
+		<< ", \"p50_ns\": " << percentile(0.50)
+		<< ", \"p99_ns\": " << percentile(0.99)
+		<< ", \"max_ns\": " << tick_ns.back()
+		<< ", \"allocs_per_tick\": " << double(allocations) / tick_count
+		<< ", \"alloc_bytes_per_tick\": " << double(allocated_bytes) / tick_count
+		<< ", \"live_bullets_per_tick\": " << double(live_bullets) / tick_count
+		<< ", \"damage\": " << damage
+		<< ", \"ack_delay\": " << ack_delay
+		<< ", \"state_full_bytes_per_tick\": " << double(full_bytes) / tick_count
+		<< ", \"state_delta_bytes_per_tick\": " << double(delta_bytes) / tick_count
+		<< ", \"state_mismatches\": " << mismatches
+		<< std::scientific << std::setprecision(2)
+		<< ", \"max_position_error\": [" << max_error.x << ", " << max_error.y << "]"
+		<< "}" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,303 @@
+//Headless load generator: many bot clients in one process, all talking to one server.
+// - each bot is an ordinary Client connection that sends C2S_Controls from a simple bot policy,
+// - decodes the S2C_State messages it gets (with Game::recv_state_message, like the real client),
+// - sends a C2S_Ping now and then and times the S2C_Pong that follows the next snapshot,
+// - prints one JSON object with totals and per-connection snapshot rate, latency, and bytes/s.
+//Usage:
+//	./swarm <host> <port> [--bots N] [--seconds S] [--warmup S] [--input-rate HZ] [--ping-rate HZ] [--seed S] [--udp | --shm]
+
+#include "Connection.hpp"
+#include "Game.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Bot {
+	Bot(uint64_t seed) : rng(seed, 0xb07) { }
+
+	std::unique_ptr< Client > client; //(null if the connection failed or was closed)
+	Game view; //latest state received from the server (own player first)
+	Player::Controls controls;
+	Random rng;
+
+	Clock::time_point next_input, next_ping;
+
+	//pings in flight, by token % size:
+	std::array< Clock::time_point, 64 > ping_sent;
+	uint32_t next_token = 0;
+
+	//stats (since the end of warmup):
+	uint64_t snapshots = 0;
+	uint64_t recv_bytes = 0;
+	uint64_t send_bytes = 0;
+	Clock::time_point first_snapshot, last_snapshot;
+	std::vector< float > latency_ms;
+	bool closed = false;
+
+	//pick controls based on the latest state:
+	void think();
+
+	void reset_stats() {
+		snapshots = 0;
+		recv_bytes = 0;
+		send_bytes = 0;
+		latency_ms.clear();
+	}
+};
+
+void Bot::think() {
+	if (view.players.empty()) return;
+	Player const &me = view.players.front();
+
+	//head for the nearest living opponent along our movement axis:
+	Player const *target = nullptr;
+	float best = 0.0f;
+	for (auto const &p : view.players) {
+		if (&p == &me || p.HP <= 0) continue;
+		glm::vec2 to = p.position - me.position;
+		float d2 = glm::dot(to, to);
+		if (!target || d2 < best) {
+			target = &p;
+			best = d2;
+		}
+	}
+
+	int axis = me.movement_index;
+	float to = (target ? target->position[axis] - me.position[axis] : 0.0f);
+	bool wander = (rng() % 16 == 0); //(so bots don't all pile up on one spot)
+	bool positive = (target ? to > 0.0f : rng() % 2 == 0);
+	if (wander) positive = !positive;
+	bool move = !target || std::abs(to) > 2.0f * Game::PlayerRadius || wander;
+
+	controls.left.pressed = (axis == 0 && move && !positive);
+	controls.right.pressed = (axis == 0 && move && positive);
+	controls.down.pressed = (axis == 1 && move && !positive);
+	controls.up.pressed = (axis == 1 && move && positive);
+	controls.jump.pressed = (rng() % 20 == 0);
+	//tap shoot (bullets fire on press) every few inputs, more often when lined up with the target:
+	bool lined_up = target && std::abs(target->position[1 - axis] - me.position[1 - axis]) < 2.0f * Game::PlayerRadius;
+	controls.shoot.pressed = !controls.shoot.pressed && (lined_up || rng() % 4 == 0);
+}
+
+int main(int argc, char **argv) {
+	std::string host, port;
+	uint32_t bot_count = 100;
+	double seconds = 10.0; //measured time
+	double warmup = 1.0; //unmeasured time first (snapshots that piled up while other bots were connecting arrive in a burst then)
+	double input_rate = 30.0; //input steps per second per bot (like the real client, a controls message only goes out when something changed, or as a keepalive)
+	double ping_rate = 5.0; //latency probes per second per bot
+	uint64_t seed = 0x5a4a;
+	Transport transport = Transport::TCP;
+
+	auto usage = [&]() {
+		std::cerr << "Usage:\n\t./swarm <host> <port> [--bots N] [--seconds S] [--warmup S] [--input-rate HZ] [--ping-rate HZ] [--seed S] [--udp | --shm]" << std::endl;
+		return 1;
+	};
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--bots" && i + 1 < argc) {
+			bot_count = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--seconds" && i + 1 < argc) {
+			seconds = std::stod(argv[++i]);
+		} else if (arg == "--warmup" && i + 1 < argc) {
+			warmup = std::stod(argv[++i]);
+		} else if (arg == "--input-rate" && i + 1 < argc) {
+			input_rate = std::stod(argv[++i]);
+		} else if (arg == "--ping-rate" && i + 1 < argc) {
+			ping_rate = std::stod(argv[++i]);
+		} else if (arg == "--seed" && i + 1 < argc) {
+			seed = std::stoull(argv[++i]);
+		} else if (arg == "--udp") {
+			transport = Transport::UDP;
+		} else if (arg == "--shm") {
+			transport = Transport::SharedMemory; //(server must be on this machine)
+		} else if (host.empty() && arg.substr(0, 2) != "--") {
+			host = arg;
+		} else if (port.empty() && arg.substr(0, 2) != "--") {
+			port = arg;
+		} else {
+			return usage();
+		}
+	}
+	if (host.empty() || port.empty() || !(seconds > 0.0) || !(warmup >= 0.0) || !(input_rate > 0.0) || !(ping_rate > 0.0)) return usage();
+
+	auto input_interval = std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(1.0 / input_rate));
+	auto ping_interval = std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(1.0 / ping_rate));
+
+	//------------ connect ------------
+	std::vector< std::unique_ptr< Bot > > bots;
+	uint32_t failed = 0;
+	{
+		//Client::Client chats on std::cout, which is reserved for the report:
+		std::streambuf *old = std::cout.rdbuf(nullptr);
+		for (uint32_t i = 0; i < bot_count; ++i) {
+			bots.emplace_back(std::make_unique< Bot >(seed + i));
+			Bot &bot = *bots.back();
+			try {
+				bot.client = std::make_unique< Client >(host, port, transport);
+			} catch (std::exception const &e) {
+				std::cerr << "bot " << i << " failed to connect: " << e.what() << std::endl;
+				++failed;
+			}
+		}
+		std::cout.rdbuf(old);
+	}
+
+	//------------ run ------------
+	auto start = Clock::now();
+	auto measure = start + std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(warmup));
+	auto stop = measure + std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(seconds));
+	bool measuring = false;
+	for (uint32_t i = 0; i < bots.size(); ++i) {
+		//spread bots' sends over the interval so they don't all arrive at once:
+		bots[i]->next_input = start + input_interval * i / bots.size();
+		bots[i]->next_ping = start + ping_interval * i / bots.size();
+	}
+
+	while (true) {
+		auto now = Clock::now();
+		if (now >= stop) break;
+		if (!measuring && now >= measure) {
+			for (auto &bot : bots) bot->reset_stats();
+			measure = now;
+			measuring = true;
+		}
+
+		bool any_open = false;
+		for (auto &bot_ : bots) {
+			Bot &bot = *bot_;
+			if (!bot.client) continue;
+			any_open = true;
+			Connection &connection = bot.client->connection;
+
+			size_t queued = connection.send_buffer.size();
+			if (now >= bot.next_input) {
+				bot.think();
+				bot.controls.sequence += 1;
+				if (bot.controls.should_send()) bot.controls.send_controls_message(&connection);
+				bot.next_input += input_interval;
+				if (bot.next_input < now) bot.next_input = now + input_interval; //(fell behind; don't burst)
+			}
+			if (now >= bot.next_ping) {
+				bot.ping_sent[bot.next_token % bot.ping_sent.size()] = now;
+				send_ping_message(&connection, Message::C2S_Ping, bot.next_token);
+				bot.next_token += 1;
+				bot.next_ping += ping_interval;
+				if (bot.next_ping < now) bot.next_ping = now + ping_interval;
+			}
+			bot.send_bytes += connection.send_buffer.size() - queued;
+
+			bot.client->poll([&](Connection *c, Connection::Event event){
+				if (event == Connection::OnClose) {
+					bot.closed = true;
+				} else if (event == Connection::OnRecv) {
+					size_t before = c->recv_buffer.size();
+					bool handled_message;
+					try {
+						do {
+							handled_message = false;
+							uint32_t token;
+							if (bot.view.recv_state_message(c)) {
+								auto at = Clock::now();
+								if (bot.snapshots == 0) bot.first_snapshot = at;
+								bot.last_snapshot = at;
+								bot.snapshots += 1;
+								handled_message = true;
+							} else if (bot.view.recv_roster_message(c)) {
+								handled_message = true;
+							} else if (recv_ping_message(c, Message::S2C_Pong, &token)) {
+								//only tokens still in the window can be timed:
+								if (token < bot.next_token && bot.next_token - token <= bot.ping_sent.size()) {
+									bot.latency_ms.emplace_back(std::chrono::duration< float, std::milli >(Clock::now() - bot.ping_sent[token % bot.ping_sent.size()]).count());
+								}
+								handled_message = true;
+							}
+						} while (handled_message);
+					} catch (std::exception const &e) {
+						std::cerr << "malformed message from server: " << e.what() << std::endl;
+						c->close();
+						bot.closed = true;
+					}
+					bot.recv_bytes += before - c->recv_buffer.size();
+				}
+			}, 0.0);
+			if (bot.closed) bot.client.reset();
+		}
+		if (!any_open) break;
+
+		//(every bot was polled without waiting, so take a short break before the next round)
+		std::this_thread::sleep_for(std::chrono::microseconds(500));
+	}
+
+	double elapsed = std::chrono::duration< double >(Clock::now() - measure).count();
+
+	//------------ report ------------
+	auto percentile = [](std::vector< float > values, double p) {
+		if (values.empty()) return 0.0f;
+		std::sort(values.begin(), values.end());
+		return values[std::min(values.size() - 1, size_t(p * values.size()))];
+	};
+	//snapshots per second, measured between the first and last snapshot:
+	auto snapshot_rate = [](Bot const &bot) {
+		if (bot.snapshots < 2) return 0.0f;
+		return float((bot.snapshots - 1) / std::chrono::duration< double >(bot.last_snapshot - bot.first_snapshot).count());
+	};
+
+	std::vector< float > all_latency;
+	std::vector< float > snapshot_rates; //(of bots that connected)
+	uint64_t total_snapshots = 0, total_recv = 0, total_send = 0;
+	uint32_t closed = 0;
+	for (auto const &bot : bots) {
+		all_latency.insert(all_latency.end(), bot->latency_ms.begin(), bot->latency_ms.end());
+		total_snapshots += bot->snapshots;
+		total_recv += bot->recv_bytes;
+		total_send += bot->send_bytes;
+		if (bot->closed) ++closed;
+		if (bot->client || bot->closed) snapshot_rates.emplace_back(snapshot_rate(*bot));
+	}
+	std::sort(snapshot_rates.begin(), snapshot_rates.end());
+	std::sort(all_latency.begin(), all_latency.end());
+
+	std::cout << std::fixed << std::setprecision(2) << "{"
+		<< "\"bots\": " << bot_count
+		<< ", \"failed_to_connect\": " << failed
+		<< ", \"closed_by_server\": " << closed
+		<< ", \"seconds\": " << elapsed
+		<< ", \"snapshots_per_s\": " << total_snapshots / elapsed
+		<< ", \"recv_bytes_per_s\": " << total_recv / elapsed
+		<< ", \"send_bytes_per_s\": " << total_send / elapsed;
+	std::cout << ", \"connection_snapshot_rate\": {"
+		<< "\"min\": " << (snapshot_rates.empty() ? 0.0f : snapshot_rates.front())
+		<< ", \"p50\": " << percentile(snapshot_rates, 0.50)
+		<< ", \"max\": " << (snapshot_rates.empty() ? 0.0f : snapshot_rates.back()) << "}";
+	std::cout << ", \"latency_ms\": {"
+		<< "\"samples\": " << all_latency.size()
+		<< ", \"p50\": " << percentile(all_latency, 0.50)
+		<< ", \"p99\": " << percentile(all_latency, 0.99)
+		<< ", \"max\": " << (all_latency.empty() ? 0.0f : all_latency.back()) << "}";
+	std::cout << ", \"connections\": [";
+	for (uint32_t i = 0; i < bots.size(); ++i) {
+		Bot const &bot = *bots[i];
+		std::cout << (i ? ",\n\t" : "\n\t") << "{"
+			<< "\"bot\": " << i
+			<< ", \"closed\": " << (bot.closed ? "true" : "false")
+			<< ", \"snapshots_per_s\": " << snapshot_rate(bot)
+			<< ", \"latency_p50_ms\": " << percentile(bot.latency_ms, 0.50)
+			<< ", \"latency_p99_ms\": " << percentile(bot.latency_ms, 0.99)
+			<< ", \"recv_bytes_per_s\": " << bot.recv_bytes / elapsed
+			<< ", \"send_bytes_per_s\": " << bot.send_bytes / elapsed
+			<< "}";
+	}
+	std::cout << "\n]}" << std::endl;
+
+	return 0;
+}